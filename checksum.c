@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "emulator.h"
+#include "checksum.h"
+
+/* ******************************************************************
+   Checksum kernels.  See checksum.h for the list of kernels.
+
+   The Internet checksum is summed in host byte order: RFC 1071 sums are
+   byte order independent, so sender and receiver agree as long as they
+   run on the same kind of machine, which is always true in the emulator.
+**********************************************************************/
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <emmintrin.h>  /* SSE2, always present on x86-64 */
+#include <nmmintrin.h>  /* SSE4.2 crc32, used only after a cpuid check */
+#define HAVE_SSE2 1
+#define HAVE_X86_CRC32 1
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define HAVE_ARM_CRC32 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u   /* Castagnoli polynomial, reflected */
+
+static int checksum_kind = CHECKSUM_SUM;   /* kernel used by pkt_checksum() */
+
+/********************* byte sum *************************/
+
+int checksum_sum(const void *data, size_t len)
+{
+  const char *p = data;
+  int sum = 0;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    sum += (int)p[i];
+  return sum;
+}
+
+/********************* Internet checksum ****************/
+
+#ifdef HAVE_SSE2
+/* add the 16 bit words of whole 16 byte blocks into 32 bit lanes.  A lane */
+/* gains at most 2*0xffff per block, so it is flushed every 4096 blocks.  */
+static uint64_t inet_sum_sse2(const unsigned char *p, size_t blocks)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i acc, v;
+  uint32_t lanes[4];
+  uint64_t total = 0;
+  size_t chunk, i;
+
+  while (blocks > 0) {
+    chunk = blocks < 4096 ? blocks : 4096;
+    acc = zero;
+    for (i = 0; i < chunk; i++) {
+      v = _mm_loadu_si128((const __m128i *)p);
+      acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+      acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+      p += 16;
+    }
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    total += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    blocks -= chunk;
+  }
+  return total;
+}
+#endif
+
+/* accumulate the one's complement sum of a buffer.  Segments can be      */
+/* chained through sum; all but the last one must have an even length.   */
+uint64_t checksum_inet_partial(uint64_t sum, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  uint64_t w;
+  uint16_t last;
+
+#ifdef HAVE_SSE2
+  if (len >= 64) {
+    sum += inet_sum_sse2(p, len / 16);
+    p += len & ~(size_t)15;
+    len &= 15;
+  }
+#endif
+  /* 64 bits at a time: adding the two 32 bit halves keeps the sum     */
+  /* congruent mod 0xffff, which is all the final fold needs            */
+  while (len >= 8) {
+    memcpy(&w, p, 8);
+    sum += (w & 0xffffffffu) + (w >> 32);
+    p += 8;
+    len -= 8;
+  }
+  while (len >= 2) {
+    memcpy(&last, p, 2);
+    sum += last;
+    p += 2;
+    len -= 2;
+  }
+  if (len) {          /* odd byte, padded with a zero byte after it */
+    last = 0;
+    memcpy(&last, p, 1);
+    sum += last;
+  }
+  return sum;
+}
+
+/* fold the accumulated sum to 16 bits and complement it */
+unsigned short checksum_inet_fold(uint64_t sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return (unsigned short)(~sum & 0xffff);
+}
+
+unsigned short checksum_inet(const void *data, size_t len)
+{
+  return checksum_inet_fold(checksum_inet_partial(0, data, len));
+}
+
+/********************* CRC32C ***************************/
+
+static uint32_t crc32c_table[8][256];
+static int crc32c_table_ready = 0;
+
+static void crc32c_init_table(void)
+{
+  uint32_t c;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++)
+      c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    crc32c_table[0][i] = c;
+  }
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      crc32c_table[k][i] = (crc32c_table[k-1][i] >> 8) ^ crc32c_table[0][crc32c_table[k-1][i] & 0xff];
+  crc32c_table_ready = 1;
+}
+
+/* slicing-by-8: eight table lookups per 8 input bytes */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint32_t lo, hi;
+
+  if (!crc32c_table_ready)
+    crc32c_init_table();
+  while (len >= 8) {
+    lo = ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24) ^ crc;
+    hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+    crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+          crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+          crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+          crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#ifdef HAVE_X86_CRC32
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t c = crc;
+  uint64_t w;
+
+  while (len >= 8) {
+    memcpy(&w, p, 8);
+    c = _mm_crc32_u64(c, w);
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    c = _mm_crc32_u8((uint32_t)c, *p++);
+  return (uint32_t)c;
+}
+
+static int crc32c_hw_ok = -1;   /* -1 until the cpu has been asked */
+#endif
+
+#ifdef HAVE_ARM_CRC32
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t w;
+
+  while (len >= 8) {
+    memcpy(&w, p, 8);
+    crc = __crc32cd(crc, w);
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc = __crc32cb(crc, *p++);
+  return crc;
+}
+#endif
+
+/* crc is the value returned for the previous segment, 0 to start */
+unsigned int checksum_crc32c(unsigned int crc, const void *data, size_t len)
+{
+  crc = ~crc;
+#if defined(HAVE_X86_CRC32)
+  if (crc32c_hw_ok < 0)
+    crc32c_hw_ok = __builtin_cpu_supports("sse4.2");
+  if (crc32c_hw_ok)
+    crc = crc32c_hw(crc, data, len);
+  else
+    crc = crc32c_sw(crc, data, len);
+#elif defined(HAVE_ARM_CRC32)
+  crc = crc32c_hw(crc, data, len);
+#else
+  crc = crc32c_sw(crc, data, len);
+#endif
+  return ~crc;
+}
+
+/* table-driven CRC32C regardless of the cpu, for the benchmark */
+unsigned int checksum_crc32c_sw(unsigned int crc, const void *data, size_t len)
+{
+  return ~crc32c_sw(~crc, data, len);
+}
+
+/********************* packet checksum ******************/
+
+int checksum_select(const char *name)
+{
+  if (strcmp(name, "sum") == 0)
+    checksum_kind = CHECKSUM_SUM;
+  else if (strcmp(name, "inet") == 0)
+    checksum_kind = CHECKSUM_INET;
+  else if (strcmp(name, "crc32c") == 0)
+    checksum_kind = CHECKSUM_CRC32C;
+  else
+    return -1;
+  return 0;
+}
+
+const char *checksum_name(void)
+{
+  if (checksum_kind == CHECKSUM_INET)
+    return "inet";
+  if (checksum_kind == CHECKSUM_CRC32C)
+    return "crc32c";
+  return "sum";
+}
+
+int pkt_checksum(const struct pkt *packet)
+{
+  int hdr[2];
+  uint64_t sum;
+  unsigned int crc;
+
+  switch (checksum_kind) {
+  case CHECKSUM_INET:
+    hdr[0] = packet->seqnum;
+    hdr[1] = packet->acknum;
+    sum = checksum_inet_partial(0, hdr, sizeof(hdr));
+    sum = checksum_inet_partial(sum, packet->payload, sizeof(packet->payload));
+    return checksum_inet_fold(sum);
+  case CHECKSUM_CRC32C:
+    hdr[0] = packet->seqnum;
+    hdr[1] = packet->acknum;
+    crc = checksum_crc32c(0, hdr, sizeof(hdr));
+    crc = checksum_crc32c(crc, packet->payload, sizeof(packet->payload));
+    return (int)crc;
+  default:
+    return packet->seqnum + packet->acknum +
+      checksum_sum(packet->payload, sizeof(packet->payload));
+  }
+}
@@ -0,0 +1,33 @@
+/* ******************************************************************
+   Checksum kernels shared by the SR and GBN entities.
+
+   - sum:    the original byte sum plus seqnum/acknum (default)
+   - inet:   RFC 1071 16 bit one's complement sum
+   - crc32c: CRC32C (Castagnoli), using the SSE4.2 / ARMv8 crc32
+             instructions when the CPU has them, slicing-by-8 otherwise
+
+   pkt_checksum() covers the seqnum, acknum and payload of a packet with
+   the kernel picked by checksum_select().
+**********************************************************************/
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHECKSUM_SUM     0
+#define CHECKSUM_INET    1
+#define CHECKSUM_CRC32C  2
+
+/* raw kernels over a byte buffer */
+extern int checksum_sum(const void *data, size_t len);
+extern uint64_t checksum_inet_partial(uint64_t sum, const void *data, size_t len);
+extern unsigned short checksum_inet_fold(uint64_t sum);
+extern unsigned short checksum_inet(const void *data, size_t len);
+extern unsigned int checksum_crc32c(unsigned int crc, const void *data, size_t len);
+extern unsigned int checksum_crc32c_sw(unsigned int crc, const void *data, size_t len);
+
+/* select the kernel by name ("sum", "inet", "crc32c"); -1 if unknown */
+extern int checksum_select(const char *name);
+extern const char *checksum_name(void);
+
+/* checksum of a packet's header fields and payload */
+struct pkt;
+extern int pkt_checksum(const struct pkt *packet);
@@ -36,30 +36,30 @@
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>       /* not time.h: time is the simulation clock here */
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <signal.h>
+#if defined(INSTRUMENT) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>       /* __rdtsc() */
+#endif
 #include "emulator.h"
+#include "eventq.h"
+#include "checksum.h"
+#include "trace.h"
 #include "sr.h"
 
-struct event {
-  float evtime;           /* event time */
-  int evtype;             /* event type code */
-  int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
-};
-
-struct event *evlist = NULL;   /* the event list */
-
-/* possible events: */
-#define  TIMER_INTERRUPT 0  
-#define  FROM_LAYER5     1
-#define  FROM_LAYER3     2
-
 #define  OFF             0
 #define  ON              1
 
 int TRACE = 3;
 
+int nflows = 1;           /* number of A/B pairs sharing the medium (-f) */
+int current_flow = 0;     /* flow of the event being processed */
+
 /* statistics updated by GBN */
 int window_full;   /* count of the number of messages dropped due to full window */
 int total_ACKs_received;
@@ -73,6 +73,8 @@ static int packets_corrupt;
 static int packets_sent;
 static int packets_timeout;
 static int messages_delivered;
+static int messages_skipped;      /* never delivered, passed over with tolayer5_skip() */
+static int naccepted;             /* messages A has taken, not dropped with a full window */
 
 static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
 static int nsimmax = 0;           /* number of msgs to generate, then stop */
@@ -81,9 +83,444 @@ static float lossprob;            /* probability that a packet is dropped  */
 static float corruptprob;   /* probability that one bit is packet is flipped */
 static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
 static float lambda;        /* arrival rate of messages from layer 5 */   
+static FILE *workload = NULL;     /* trace of layer 5 arrivals to replay (-w) */
+static long  workload_lines;      /* lines read so far, for errors */
+static long  workload_records;    /* records read so far */
+static double workload_start;     /* timestamp of the first record */
+static double workload_when;      /* arrival time of the current record */
+static long  workload_bytes;      /* bytes of the current record not yet scheduled */
+static int   workload_len;        /* length of the scheduled message, <= 20 */
 static int   ntolayer3;           /* number sent into layer 3 */
 static int   nlost;               /* number lost in media */
 static int ncorrupt;              /* number corrupted by media*/
+static int bench = 0;             /* print speed statistics at the end (-b) */
+static long nevents;              /* events dispatched */
+static long nallocs;              /* allocations made by the emulator */
+static float channel_last[2];     /* latest arrival scheduled at A and at B */
+static unsigned int seed = 9999;  /* of rand() (-S) */
+static unsigned long nrand;       /* rand() calls since srand(seed), for checkpoints */
+static char *ckpt_path = NULL;    /* checkpoint written every ckpt_every messages (-C) */
+static int ckpt_every;
+static int ckpt_next;             /* nsim at which the next checkpoint is written */
+static char *restore_path = NULL; /* checkpoint to start from (-R) */
+static int nreps = 0;             /* replications of the run (-r), 0 for a single run */
+static double rep_target = 0.0;   /* stop when every 95% CI is this narrow, relative to its mean */
+static int njobs = 0;             /* replications run at once (-j), 0 for one per cpu */
+static int rep_index;             /* replication run by this process */
+static int rep_fd = -1;           /* where a replication writes its result, -1 if not one */
+static double win_width = 0.0;    /* -i, 0 for no windows */
+static char *win_path = NULL;     /* CSV file for the series, NULL for stdout */
+
+static void replicate(void);
+static void window_save(FILE *);
+static void window_restore(FILE *);
+
+/* per flow state of the emulator */
+struct flow {
+  int nsim;                 /* messages from layer 5 so far */
+  int delivered;            /* messages delivered to layer 5 */
+  struct event *timer[2];   /* pending timer of A and B, NULL if not running */
+  int pareto_left;          /* pareto: messages left in this ON period */
+  int mmpp_busy;            /* mmpp: current state */
+  double mmpp_left;         /* mmpp: time left in current state */
+};
+
+static struct flow *flows = NULL;   /* nflows entries */
+static int workload_flow;           /* flow of the current record */
+
+#define FLOWS_LISTED 16     /* flows listed one by one in the final report */
+
+/************************** STREAMING STATISTICS ***************/
+/* With -s, the delay of every delivered message goes into a histogram of
+   fixed size, and the resends of every acknowledged packet into a fixed
+   size reservoir sample, so the memory used does not grow with the run.
+
+   The histogram is log-linear, as in HDR histograms: delays are counted
+   in units of 1/HDR_SCALE time units, values below HDR_SUB each have a
+   bucket, and every power of two above is split into HDR_SUB/2 buckets,
+   so a percentile is within 1/64 of the true value.  The reservoir keeps
+   a uniform sample of RESERVOIR counts (Algorithm R), drawn with its own
+   generator so that the simulation's rand() sequence is untouched. */
+
+#define HDR_SCALE   1024.0          /* histogram units per time unit */
+#define HDR_SUB     128
+#define HDR_BUCKETS (HDR_SUB + (64 - 7) * HDR_SUB / 2)
+#define RESERVOIR   1024
+
+static int sketches = 0;            /* -s */
+static long hdr_counts[HDR_BUCKETS];
+static long hdr_n;
+static double hdr_sum, hdr_min, hdr_max;
+
+static int resend_sample[RESERVOIR];
+static long resend_n;               /* packets acknowledged */
+static long resend_sum;
+static int resend_max;
+static unsigned long long resend_rng = 88172645463325252ULL;
+
+static int hdr_index(unsigned long long v)
+{
+  int shift;
+
+  if (v < HDR_SUB)
+    return (int)v;
+  shift = 63 - __builtin_clzll(v) - 6;   /* v >> shift is in [64, 127] */
+  return HDR_SUB + (shift - 1) * HDR_SUB / 2 + (int)(v >> shift) - HDR_SUB / 2;
+}
+
+/* middle of a bucket, in time units */
+static double hdr_value(int i)
+{
+  int shift;
+  unsigned long long low;
+
+  if (i < HDR_SUB)
+    return i / HDR_SCALE;
+  shift = (i - HDR_SUB) / (HDR_SUB / 2) + 1;
+  low = (unsigned long long)((i - HDR_SUB) % (HDR_SUB / 2) + HDR_SUB / 2) << shift;
+  return (low + (1ULL << shift) / 2.0) / HDR_SCALE;
+}
+
+static void hdr_add(double delay)
+{
+  double v = delay * HDR_SCALE;
+
+  if (v < 0.0)
+    v = 0.0;
+  if (v > 9.2e18)
+    v = 9.2e18;
+  hdr_counts[hdr_index((unsigned long long)v)]++;
+  if (hdr_n == 0 || delay < hdr_min)
+    hdr_min = delay;
+  if (hdr_n == 0 || delay > hdr_max)
+    hdr_max = delay;
+  hdr_n++;
+  hdr_sum += delay;
+}
+
+static double hdr_percentile(double p)
+{
+  long rank = (long)(p * hdr_n + 0.999999), seen = 0;
+  int i;
+
+  if (rank < 1)
+    rank = 1;
+  for (i=0; i<HDR_BUCKETS; i++) {
+    seen += hdr_counts[i];
+    if (seen >= rank)
+      return hdr_value(i) < hdr_max ? hdr_value(i) : hdr_max;
+  }
+  return hdr_max;
+}
+
+/* called by the sender when a packet is acknowledged */
+void record_resends(int resends)
+{
+  unsigned long long j;
+
+  if (!sketches)
+    return;
+  resend_sum += resends;
+  if (resends > resend_max)
+    resend_max = resends;
+  if (resend_n < RESERVOIR)
+    resend_sample[resend_n] = resends;
+  else {
+    resend_rng ^= resend_rng << 13;    /* xorshift64 */
+    resend_rng ^= resend_rng >> 7;
+    resend_rng ^= resend_rng << 17;
+    j = resend_rng % (resend_n + 1);
+    if (j < RESERVOIR)
+      resend_sample[j] = resends;
+  }
+  resend_n++;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+static void print_sketches(void)
+{
+  int n = resend_n < RESERVOIR ? (int)resend_n : RESERVOIR;
+
+  printf("delay from layer 5 at A to layer 5 at B, %ld messages (histogram, within 1/64):\n", hdr_n);
+  if (hdr_n > 0)
+    printf("  mean %f, min %f, p50 %f, p90 %f, p99 %f, p99.9 %f, max %f\n",
+           hdr_sum / hdr_n, hdr_min, hdr_percentile(0.5), hdr_percentile(0.9),
+           hdr_percentile(0.99), hdr_percentile(0.999), hdr_max);
+  printf("resends per acknowledged packet, %ld packets (sample of %d):\n", resend_n, n);
+  if (n > 0) {
+    qsort(resend_sample, n, sizeof(int), cmp_int);
+    printf("  mean %f, max %d; sample p50 %d, p90 %d, p99 %d\n",
+           (double)resend_sum / resend_n, resend_max, resend_sample[n / 2],
+           resend_sample[(int)(n * 0.9)], resend_sample[(int)(n * 0.99)]);
+  }
+  else
+    printf("  none reported by the protocol\n");
+}
+
+/* times at which A took the messages not delivered yet, oldest first, per
+   flow.  SR and GBN deliver in order, so the oldest is the next one to
+   reach layer 5 at B.  Only kept by replications (-r) and with -s. */
+struct delayq {
+  double *t;
+  int head, len, size;
+};
+
+static struct delayq *delayqs = NULL;
+static double delay_sum;          /* of the delays of delivered messages */
+static long delay_n;
+
+static void delay_push(int flow, double t)
+{
+  struct delayq *q = &delayqs[flow];
+  double *grown;
+  int i;
+
+  if (q->len == q->size) {
+    grown = malloc((q->size ? 2 * q->size : 64) * sizeof(double));
+    if (grown == NULL) {
+      printf("memory allocation for delays failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<q->len; i++)
+      grown[i] = q->t[(q->head + i) % q->size];
+    free(q->t);
+    q->t = grown;
+    q->head = 0;
+    q->size = q->size ? 2 * q->size : 64;
+  }
+  q->t[(q->head + q->len++) % q->size] = t;
+}
+
+static void delay_pop(int flow, double now)
+{
+  struct delayq *q = &delayqs[flow];
+
+  if (q->len == 0)
+    return;
+  delay_sum += now - q->t[q->head];
+  delay_n++;
+  if (sketches)
+    hdr_add(now - q->t[q->head]);
+  q->head = (q->head + 1) % q->size;
+  q->len--;
+}
+
+/* checkpoints carry the sketches and the delay queues: restored without
+   them, a run would sketch only what came after the restore, and time
+   its deliveries against the wrong messages */
+static void sketch_save(FILE *fp)
+{
+  int i, j;
+
+  if (sketches) {
+    ckpt_write(fp, hdr_counts, sizeof(hdr_counts));
+    ckpt_write(fp, &hdr_n, sizeof(hdr_n));
+    ckpt_write(fp, &hdr_sum, sizeof(hdr_sum));
+    ckpt_write(fp, &hdr_min, sizeof(hdr_min));
+    ckpt_write(fp, &hdr_max, sizeof(hdr_max));
+    ckpt_write(fp, resend_sample, sizeof(resend_sample));
+    ckpt_write(fp, &resend_n, sizeof(resend_n));
+    ckpt_write(fp, &resend_sum, sizeof(resend_sum));
+    ckpt_write(fp, &resend_max, sizeof(resend_max));
+    ckpt_write(fp, &resend_rng, sizeof(resend_rng));
+  }
+  if (delayqs != NULL) {
+    ckpt_write(fp, &delay_sum, sizeof(delay_sum));
+    ckpt_write(fp, &delay_n, sizeof(delay_n));
+    for (i=0; i<nflows; i++) {
+      ckpt_write(fp, &delayqs[i].len, sizeof(int));
+      for (j=0; j<delayqs[i].len; j++)
+        ckpt_write(fp, &delayqs[i].t[(delayqs[i].head + j) % delayqs[i].size], sizeof(double));
+    }
+  }
+}
+
+static void sketch_restore(FILE *fp)
+{
+  double t;
+  int i, j, len;
+
+  if (sketches) {
+    ckpt_read(fp, hdr_counts, sizeof(hdr_counts));
+    ckpt_read(fp, &hdr_n, sizeof(hdr_n));
+    ckpt_read(fp, &hdr_sum, sizeof(hdr_sum));
+    ckpt_read(fp, &hdr_min, sizeof(hdr_min));
+    ckpt_read(fp, &hdr_max, sizeof(hdr_max));
+    ckpt_read(fp, resend_sample, sizeof(resend_sample));
+    ckpt_read(fp, &resend_n, sizeof(resend_n));
+    ckpt_read(fp, &resend_sum, sizeof(resend_sum));
+    ckpt_read(fp, &resend_max, sizeof(resend_max));
+    ckpt_read(fp, &resend_rng, sizeof(resend_rng));
+  }
+  if (delayqs != NULL) {
+    ckpt_read(fp, &delay_sum, sizeof(delay_sum));
+    ckpt_read(fp, &delay_n, sizeof(delay_n));
+    for (i=0; i<nflows; i++) {
+      ckpt_read(fp, &len, sizeof(int));
+      delayqs[i].head = delayqs[i].len = 0;
+      for (j=0; j<len; j++) {
+        ckpt_read(fp, &t, sizeof(double));
+        delay_push(i, t);
+      }
+    }
+  }
+}
+
+/********************** INSTRUMENTATION *******************/
+/* Compiled in with -DINSTRUMENT, and printed after the final statistics: */
+/* events dispatched by type, time spent in each protocol callback with a */
+/* log2 histogram, timer starts, stops and expiries, and the number of    */
+/* pending events over time.  Without the flag the hooks compile to       */
+/* nothing.                                                               */
+
+#ifdef INSTRUMENT
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INSTR_UNIT "TSC cycles"
+static unsigned long long instr_clock(void)
+{
+  return __rdtsc();
+}
+#elif defined(__aarch64__)
+#define INSTR_UNIT "counter ticks"
+static unsigned long long instr_clock(void)
+{
+  unsigned long long t;
+
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+  return t;
+}
+#else
+#define INSTR_UNIT "us"
+static unsigned long long instr_clock(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+#endif
+
+#define INSTR_BUCKETS 40     /* histogram bucket b: 2^b <= duration < 2^(b+1) */
+#define DEPTH_SAMPLES 32     /* samples of the queue depth kept */
+
+/* one protocol callback, indexed by event type and entity */
+struct callback_stats {
+  const char *name;
+  long events;               /* events of this type and entity dispatched */
+  long calls;                /* calls made (layer 5 events stop at nsimmax) */
+  unsigned long long total;
+  long hist[INSTR_BUCKETS];
+};
+
+static struct callback_stats callbacks[3][2] = {
+  { { "A_timerinterrupt" }, { "B_timerinterrupt" } },   /* TIMER_INTERRUPT */
+  { { "A_output" },         { "B_output" } },           /* FROM_LAYER5 */
+  { { "A_input" },          { "B_input" } },            /* FROM_LAYER3 */
+};
+
+static unsigned long long instr_started;   /* clock at the current callback */
+static long timer_starts, timer_stops;   /* expiries are packets_timeout */
+static long depth, depth_max;      /* events pending */
+static double depth_area;          /* integral of depth over simulated time */
+static float depth_since;          /* time of the last change of depth */
+static struct { float time; long depth; } depth_samples[DEPTH_SAMPLES];
+static int ndepth_samples;
+static long depth_every = 1;       /* events between samples, doubles when full */
+static long depth_countdown = 1;
+
+/* an event was dispatched: count it and sample the queue depth */
+static void instr_event(struct event *e)
+{
+  int i;
+
+  callbacks[e->evtype][e->eventity].events++;
+  if (--depth_countdown > 0)
+    return;
+  if (ndepth_samples == DEPTH_SAMPLES) {
+    /* keep every other sample and sample half as often */
+    for (i = 0; i < DEPTH_SAMPLES / 2; i++)
+      depth_samples[i] = depth_samples[2 * i + 1];
+    ndepth_samples = DEPTH_SAMPLES / 2;
+    depth_every *= 2;
+  }
+  depth_samples[ndepth_samples].time = time;
+  depth_samples[ndepth_samples].depth = depth;
+  ndepth_samples++;
+  depth_countdown = depth_every;
+}
+
+static void instr_queue(int delta)
+{
+  depth_area += depth * (double)(time - depth_since);
+  depth_since = time;
+  depth += delta;
+  if (depth > depth_max)
+    depth_max = depth;
+}
+
+static void instr_start(void)
+{
+  instr_started = instr_clock();
+}
+
+static void instr_stop(struct event *e)
+{
+  struct callback_stats *c = &callbacks[e->evtype][e->eventity];
+  unsigned long long d = instr_clock() - instr_started;
+  int b = 0;
+
+  c->calls++;
+  c->total += d;
+  while (d > 1 && b < INSTR_BUCKETS - 1) {
+    d >>= 1;
+    b++;
+  }
+  c->hist[b]++;
+}
+
+static void instr_timer(long *counter)
+{
+  (*counter)++;
+}
+
+static void print_instr_stats(void)
+{
+  struct callback_stats *c;
+  int t, e, b;
+
+  printf("instrumentation (durations in " INSTR_UNIT "):\n");
+  printf("  callback              events      calls        mean  histogram (log2 duration:calls)\n");
+  for (t = 0; t < 3; t++)
+    for (e = 0; e < 2; e++) {
+      c = &callbacks[t][e];
+      printf("  %-18s %9ld  %9ld  %10.1f ", c->name, c->events, c->calls,
+             c->calls > 0 ? (double)c->total / c->calls : 0.0);
+      for (b = 0; b < INSTR_BUCKETS; b++)
+        if (c->hist[b] > 0)
+          printf(" %d:%ld", b, c->hist[b]);
+      printf("\n");
+    }
+  printf("  timers: %ld started, %ld stopped, %d expired\n", timer_starts, timer_stops, packets_timeout);
+  printf("  packets sent by A (with resends): %d\n", packets_sent);
+  printf("  pending events: max %ld, time average %.2f\n", depth_max,
+         time > 0.0 ? (depth_area + depth * (double)(time - depth_since)) / time : 0.0);
+  printf("  %12s %8s\n", "time", "pending");
+  for (t = 0; t < ndepth_samples; t++)
+    printf("  %12.3f %8ld\n", depth_samples[t].time, depth_samples[t].depth);
+}
+
+#else
+#define instr_event(e)
+#define instr_queue(delta)
+#define instr_start()
+#define instr_stop(e)
+#define instr_timer(counter)
+#endif
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
@@ -95,6 +532,7 @@ double jimsrand(void)
   double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
   double x;                   
   x = rand()/mmm;            /* x should be uniform in [0,1] */
+  nrand++;
   if (TRACE > 3)
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
@@ -104,44 +542,220 @@ double jimsrand(void)
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
+/* the queue itself is in eventq.c */
 void insertevent(struct event *p)
 {
-  struct event *q,*qold;
-
   if (TRACE>2) {
     printf("            INSERTEVENT: time is %f\n",time);
     printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
   }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
+  instr_queue(1);
+  eventq_insert(p);
+}
+
+/********************** ARRIVAL PROCESSES *******************/
+/* Each generator returns the time until the next message from layer 5 */
+/* of flow f.  All of them have a long run mean of lambda between      */
+/* messages; state of the bursty sources is kept per flow.            */
+
+static double pareto_alpha = 1.5;  /* pareto: shape of ON/OFF durations */
+static double pareto_burst = 10;   /* pareto: mean messages per ON period */
+static double mmpp_ratio = 4;      /* mmpp: rate of busy state / rate of quiet state */
+static double mmpp_sojourn = 0;    /* mmpp: mean time in a state, 10*lambda if 0 */
+
+/* exponential with the given mean; jimsrand() can return 1.0 */
+static double exponential(double mean)
+{
+  double u;
+
+  u = jimsrand();
+  if (u >= 1.0)
+    u = 1.0 - 1e-9;
+  return -mean * log(1.0 - u);
+}
+
+/* pareto with the given mean and shape alpha > 1 */
+static double pareto(double mean, double alpha)
+{
+  double u;
+
+  u = jimsrand();
+  if (u <= 0.0)
+    u = 1e-9;
+  return mean * (alpha - 1) / alpha / pow(u, 1.0 / alpha);
+}
+
+/* the original source: uniform on [0,2*lambda] */
+static double arrival_uniform(struct flow *f)
+{
+  return lambda*jimsrand()*2;
+}
+
+/* Poisson process */
+static double arrival_poisson(struct flow *f)
+{
+  return exponential(lambda);
+}
+
+/* constant bit rate */
+static double arrival_cbr(struct flow *f)
+{
+  return lambda;
+}
+
+/* ON/OFF source with Pareto distributed period lengths.  While ON, messages
+   come every lambda/2; OFF periods are as long as ON periods on average,
+   so the mean rate is still one message per lambda. */
+static double arrival_pareto(struct flow *f)
+{
+  double spacing, on, off;
+
+  spacing = lambda / 2;
+  if (f->pareto_left > 0) {
+    f->pareto_left--;
+    return spacing;
   }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
-    }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
+  off = pareto(pareto_burst * spacing, pareto_alpha);
+  on = pareto(pareto_burst * spacing, pareto_alpha);
+  f->pareto_left = (int)(on / spacing + 0.5);
+  if (f->pareto_left > 0)
+    f->pareto_left--;          /* this message opens the ON period */
+  return off + spacing;
+}
+
+/* two state Markov modulated Poisson process.  Both states last
+   mmpp_sojourn on average; the busy state sends mmpp_ratio times faster
+   than the quiet one, with rates chosen so the mean gap stays lambda. */
+static double arrival_mmpp(struct flow *f)
+{
+  double quiet, rate, gap, waited;
+
+  quiet = 2.0 / (lambda * (1 + mmpp_ratio));
+  waited = 0;
+  for (;;) {
+    rate = f->mmpp_busy ? quiet * mmpp_ratio : quiet;
+    gap = exponential(1.0 / rate);
+    if (gap <= f->mmpp_left) {
+      f->mmpp_left -= gap;
+      return waited + gap;
     }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
+    /* state changes first; the process is memoryless so just redraw */
+    waited += f->mmpp_left;
+    f->mmpp_busy = !f->mmpp_busy;
+    f->mmpp_left = exponential(mmpp_sojourn);
+  }
+}
+
+struct arrival_process {
+  const char *name;
+  double (*next)(struct flow *f);
+};
+
+static struct arrival_process arrivals[] = {
+  { "uniform", arrival_uniform },
+  { "poisson", arrival_poisson },
+  { "cbr",     arrival_cbr },
+  { "pareto",  arrival_pareto },
+  { "mmpp",    arrival_mmpp },
+};
+
+static struct arrival_process *arrival = &arrivals[0];
+
+/* select an arrival process from "name[:param[:param]]"; -1 if unknown
+   pareto:alpha:burst   shape (> 1) and mean messages per ON period
+   mmpp:ratio:sojourn   busy/quiet rate ratio and mean state duration */
+static int arrival_select(const char *spec)
+{
+  char name[32];
+  double p1, p2;
+  int n;
+  unsigned int i;
+
+  n = sscanf(spec, "%31[^:]:%lf:%lf", name, &p1, &p2);
+  if (n < 1)
+    return -1;
+  for (i=0; i<sizeof(arrivals)/sizeof(arrivals[0]); i++)
+    if (strcmp(arrivals[i].name, name) == 0)
+      break;
+  if (i == sizeof(arrivals)/sizeof(arrivals[0]))
+    return -1;
+  arrival = &arrivals[i];
+  if (arrival->next == arrival_pareto) {
+    if (n >= 2)
+      pareto_alpha = p1;
+    if (n >= 3)
+      pareto_burst = p2;
+    if (pareto_alpha <= 1.0 || pareto_burst < 1.0)
+      return -1;
+  }
+  else if (arrival->next == arrival_mmpp) {
+    if (n >= 2)
+      mmpp_ratio = p1;
+    if (n >= 3)
+      mmpp_sojourn = p2;
+    if (mmpp_ratio <= 0.0 || mmpp_sojourn < 0.0)
+      return -1;
+  }
+  return 0;
+}
+
+/* replayed arrivals: the workload file holds one "timestamp size [flow]"
+   record per line (blank lines and lines starting with # are skipped).  A
+   record of size bytes arrives as ceil(size/20) messages at the same time
+   at flow (default 0), which must be one of the -f flows; timestamps are
+   taken relative to the first record and must not go backwards.  Returns 0
+   once the file is exhausted. */
+static int workload_next(double *when)
+{
+  char line[256];
+  double ts;
+  long size;
+  int flow;
+
+  while (workload_bytes <= 0) {
+    if (fgets(line, sizeof(line), workload) == NULL)
+      return 0;
+    workload_lines++;
+    flow = 0;
+    if (sscanf(line, "%lf %ld %d", &ts, &size, &flow) < 2)
+      continue;
+    if (flow < 0 || flow >= nflows) {
+      printf("workload file line %ld: flow %d is not one of flows 0 to %d (-f)\n",
+             workload_lines, flow, nflows - 1);
+      exit(EXIT_FAILURE);
     }
+    if (workload_records++ == 0)
+      workload_start = ts;
+    ts -= workload_start;
+    if (ts < time)
+      ts = time;
+    workload_when = ts;
+    workload_bytes = size;
+    workload_flow = flow;
+  }
+  workload_len = workload_bytes < 20 ? workload_bytes : 20;
+  workload_bytes -= workload_len;
+  *when = workload_when;
+  return 1;
+}
+
+/* payload of replayed message n: letters from a generator seeded with n, so
+   a given message always carries the same data; bytes past len are blanks */
+static void workload_payload(char data[20], int n, int len)
+{
+  unsigned int x;
+  int i;
+
+  x = 2166136261u ^ (unsigned int)n;
+  for (i=0; i<20; i++) {
+    x = x * 1103515245u + 12345u;
+    data[i] = i < len ? 'a' + (x >> 16) % 26 : ' ';
   }
 }
 
-void generate_next_arrival(void)
+/* schedule the next message of a flow.  A workload file is a single
+   stream for all flows, so there the flow comes from the record. */
+void generate_next_arrival(int flow)
 {
   double x;
   struct event *evptr;
@@ -149,9 +763,16 @@ void generate_next_arrival(void)
   if (TRACE>2)
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
+  if (workload != NULL) {
+    if (!workload_next(&x))
+      return;                 /* trace exhausted: no more arrivals */
+    x -= time;
+    flow = workload_flow;
+  }
+  else
+    x = arrival->next(&flows[flow]);   /* mean of lambda, uniform unless -a is given */
   evptr = malloc(sizeof(struct event));
+  nallocs++;
   if (evptr == 0) {
     printf("memory allocation for event failed.");
     exit(EXIT_FAILURE);
@@ -162,17 +783,13 @@ void generate_next_arrival(void)
     evptr->eventity = B;
   else
     evptr->eventity = A;
+  evptr->evflow = flow;
   insertevent(evptr);
 } 
 
 void printevlist(void)
 {
-  struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
-  }
-  printf("--------------\n");
+  eventq_print();
 }
 
 void init(void)                         /* initialize the simulator */
@@ -195,9 +812,11 @@ void init(void)                         /* initialize the simulator */
   scanf("%f",&lambda);
   printf("Enter TRACE:");
   scanf("%d",&TRACE);
+  if (nreps > 0)
+    replicate();            /* returns in each replication, with its seed */
 
-
-  srand(9999);              /* init random number generator */
+  srand(seed);              /* init random number generator */
+  nrand = 0;
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
     sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
@@ -220,13 +839,42 @@ void init(void)                         /* initialize the simulator */
   packets_sent = 0;
   packets_timeout = 0;
   messages_delivered = 0;
+  messages_skipped = 0;
+  naccepted = 0;
 
   ntolayer3 = 0;
   nlost = 0;
   ncorrupt = 0;
+  nevents = 0;
+  nallocs = 0;
+
+  channel_last[A] = 0.0;
+  channel_last[B] = 0.0;
+
+  if (mmpp_sojourn == 0)
+    mmpp_sojourn = 10 * lambda;
+  flows = calloc(nflows, sizeof(struct flow));
+  nallocs++;
+  if (flows == NULL) {
+    printf("memory allocation for flows failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<nflows; i++)
+    flows[i].mmpp_left = mmpp_sojourn;
+  if (rep_fd >= 0 || sketches) {
+    delayqs = calloc(nflows, sizeof(struct delayq));
+    if (delayqs == NULL) {
+      printf("memory allocation for delays failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
 
   time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  if (workload != NULL)
+    generate_next_arrival(0);  /* one stream feeds every flow */
+  else
+    for (i=0; i<nflows; i++)
+      generate_next_arrival(i);   /* initialize event list */
 }
 
 /********************** Student-callable ROUTINES ***********************/
@@ -239,26 +887,18 @@ void stoptimer(int AorB)
 
   if (TRACE>1)
     printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+  TRACE_EVENT(TR_TIMER_STOP, AorB, -1, -1, 0);
+  /* each flow remembers its pending timers, so no search of evlist */
+  q = flows[current_flow].timer[AorB];
+  if (q == NULL) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  eventq_remove(q);     /* O(1) while the timer is in the wheel */
+  instr_queue(-1);
+  instr_timer(&timer_stops);
+  free(q);
+  flows[current_flow].timer[AorB] = NULL;
 }
 
 
@@ -266,21 +906,20 @@ void starttimer(int AorB, double increment)
 /* A or B is trying to start timer */
 {
 
-  struct event *q;
   struct event *evptr;
 
   if (TRACE>1)
     printf("          START TIMER: starting timer at %f\n",time);
+  TRACE_EVENT(TR_TIMER_START, AorB, -1, -1, 0);
   /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
+  if (flows[current_flow].timer[AorB] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
  
   /* create future event for when timer goes off */
   evptr = malloc(sizeof(struct event));
+  nallocs++;
   if (evptr == 0) {
     printf("memory allocation for event failed.");
     exit(EXIT_FAILURE);
@@ -290,74 +929,130 @@ void starttimer(int AorB, double increment)
    
  
   evptr->eventity = AorB;
+  evptr->evflow = current_flow;
+  flows[current_flow].timer[AorB] = evptr;
+  instr_timer(&timer_starts);
   insertevent(evptr);
 } 
 
+/* the simulation clock, for protocols that keep deadlines of their own */
+double get_sim_time(void)
+{
+  return time;
+}
+
+
+/************************** PACKET POOL ***************/
+/* every packet crossing layer 3 lives in one of these buffers.  The pkt   */
+/* must stay the first member: a packet handle is a pointer to it.         */
+struct pktbuf {
+  struct pkt pkt;
+  int refcount;
+  struct pktbuf *nextfree;
+};
+
+#define PKTPOOL_CHUNK 64          /* buffers added to the pool at a time */
+
+static struct pktbuf *pktfree = NULL;   /* free list of packet buffers */
+
+struct pkt *pkt_alloc(void)
+{
+  struct pktbuf *b;
+  int i;
+
+  if (pktfree == NULL) {
+    b = malloc(PKTPOOL_CHUNK * sizeof(struct pktbuf));
+    nallocs++;
+    if (b == 0) {
+      printf("memory allocation for packet pool failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<PKTPOOL_CHUNK; i++) {
+      b[i].nextfree = pktfree;
+      pktfree = &b[i];
+    }
+  }
+  b = pktfree;
+  pktfree = b->nextfree;
+  b->refcount = 1;
+  return &b->pkt;
+}
+
+void pkt_hold(struct pkt *packet)
+{
+  ((struct pktbuf *)packet)->refcount++;
+}
+
+void pkt_release(struct pkt *packet)
+{
+  struct pktbuf *b = (struct pktbuf *)packet;
+
+  if (--b->refcount == 0) {
+    b->nextfree = pktfree;
+    pktfree = b;
+  }
+}
 
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
+void tolayer3_ref(int AorB, struct pkt *packet)
 /* A or B is sending to network  */
 {
   struct pkt *mypktptr;
-  struct event *evptr,*q;
+  struct event *evptr;
   float lastime, x;
   int i;
 
   ntolayer3++;
+  if (AorB == A)
+    packets_sent++;
 
   /* simulate losses: */
   if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
     nlost++;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being lost\n");
+    TRACE_EVENT(TR_LOST, AorB, packet->seqnum, packet->acknum, 0);
     return;
   }  
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
   if (TRACE>2)  {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum,  mypktptr->checksum);
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", packet->seqnum,
+           packet->acknum,  packet->checksum);
     for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
+      printf("%c",packet->payload[i]);
     printf("\n");
   }
+  TRACE_EVENT(TR_TOLAYER3, AorB, packet->seqnum, packet->acknum, 0);
 
   /* create future event for arrival of packet at the other side */
   evptr = malloc(sizeof(struct event));
+  nallocs++;
   if (evptr == 0) {
     printf("memory allocation for event failed.");
     exit(EXIT_FAILURE);
   }
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+  evptr->evflow = current_flow;   /* ... of the same flow */
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
+     currently in the medium on their way to the destination.  All flows
+     share the medium, so that is the latest arrival of any flow. */
   lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
+  if (channel_last[evptr->eventity] > lastime)
+    lastime = channel_last[evptr->eventity];
   evptr->evtime =  lastime + 1 + 9*jimsrand();
+  channel_last[evptr->eventity] = evptr->evtime;
  
 
 
   /* simulate corruption: */
   if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
     ncorrupt++;
+    /* the sender may still hold this packet, so corrupt a private copy */
+    mypktptr = pkt_alloc();
+    *mypktptr = *packet;
     if ( (x = jimsrand()) < .75)
       mypktptr->payload[0]='Z';   /* corrupt payload */
     else if (x < .875)
@@ -366,13 +1061,32 @@ void tolayer3(int AorB, struct pkt packet)
       mypktptr->acknum = 999999;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being corrupted\n");
+    TRACE_EVENT(TR_CORRUPT, AorB, mypktptr->seqnum, mypktptr->acknum, 0);
   }  
+  else {
+    /* no copy: the medium just keeps a reference to the sender's packet */
+    pkt_hold(packet);
+    mypktptr = packet;
+  }
+  evptr->pktptr = mypktptr;       /* save ptr to packet in the medium */
 
   if (TRACE>2)  
     printf("          TOLAYER3: scheduling arrival on other side\n");
   insertevent(evptr);
 } 
 
+/* by-value interface kept for compatibility: wraps the packet in a pool */
+/* buffer and hands it to tolayer3_ref() */
+void tolayer3(int AorB, struct pkt packet)
+{
+  struct pkt *mypktptr;
+
+  mypktptr = pkt_alloc();
+  *mypktptr = packet;
+  tolayer3_ref(AorB, mypktptr);
+  pkt_release(mypktptr);
+}
+
 void tolayer5(int AorB, char datasent[20])
 {
   int i;  
@@ -386,28 +1100,910 @@ void tolayer5(int AorB, char datasent[20])
       printf("%c",datasent[i]);
     printf("\n");
   }
+  TRACE_EVENT(TR_TOLAYER5, AorB, -1, -1, 0);
   messages_delivered++;
+  flows[current_flow].delivered++;
+  if (delayqs != NULL)
+    delay_pop(current_flow, time);
+}
+
+/* the message B would deliver next was abandoned by A and never arrived:
+   it leaves the delays without one of its own */
+void tolayer5_skip(int AorB)
+{
+  struct delayq *q;
+
+  if (TRACE>2)
+    printf("          TOLAYER5: message skipped at %c\n", AorB == A ? 'A' : 'B');
+  messages_skipped++;
+  if (delayqs != NULL) {
+    q = &delayqs[current_flow];
+    if (q->len > 0) {
+      q->head = (q->head + 1) % q->size;
+      q->len--;
+    }
+  }
+}
+
+/************************** CHECKPOINTS ***************/
+/* A checkpoint holds everything the rest of a run depends on: the pending
+   events with their packets, the counters, the per flow state, the place
+   in the workload file, the trace ring and, from protocol_save(), the
+   state of the protocol.  rand() cannot save its state, so the number of
+   calls since srand(seed) is kept and replayed on restore.  What is read
+   from stdin is not saved: the same values continue the run exactly, and
+   other ones (loss, corruption, more messages) branch it from there.  The
+   options must be the same, apart from -C, -R, -b and -t. */
+
+#define CKPT_MAGIC   "EMUCKPT"
+#define CKPT_VERSION 12
+
+struct ckpt_header {
+  char magic[8];
+  unsigned int version;
+  unsigned int pktsize;         /* sizeof(struct pkt) */
+  unsigned int evsize;          /* sizeof(struct event) */
+  int nflows;
+  char checksum[16];            /* kernel that made the packet checksums */
+};
+
+/* emulator state, written as one block */
+struct ckpt_state {
+  float time;
+  int nsim, naccepted;
+  unsigned int seed;
+  unsigned long nrand;
+  int window_full, total_ACKs_received, packets_resent, new_ACKs, packets_received;
+  int packets_lost, packets_corrupt, packets_sent, packets_timeout;
+  int messages_delivered, messages_skipped;
+  int ntolayer3, nlost, ncorrupt;
+  long nevents;
+  float channel_last[2];
+  int workload;                 /* replaying a workload file */
+  long workload_offset;         /* position in it */
+  long workload_lines, workload_records, workload_bytes;
+  double workload_start, workload_when;
+  int workload_len, workload_flow;
+  unsigned int trace_ring_next, trace_ring_dumped;
+  int sketches, delays;         /* -s, and delay queues (-s or -r): sketch_save() follows */
+  double win_width;             /* -i: window_save() follows */
+  long nqueued;                 /* pending events that follow */
+};
+
+void ckpt_write(FILE *fp, const void *data, size_t len)
+{
+  if (fwrite(data, len, 1, fp) != 1) {
+    printf("cannot write checkpoint\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void ckpt_read(FILE *fp, void *data, size_t len)
+{
+  if (fread(data, len, 1, fp) != 1) {
+    printf("checkpoint is truncated\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void ckpt_write_pkt(FILE *fp, const struct pkt *packet)
+{
+  char present = packet != NULL;
+
+  ckpt_write(fp, &present, 1);
+  if (present)
+    ckpt_write(fp, packet, sizeof(struct pkt));
+}
+
+struct pkt *ckpt_read_pkt(FILE *fp)
+{
+  struct pkt *packet;
+  char present;
+
+  ckpt_read(fp, &present, 1);
+  if (!present)
+    return NULL;
+  packet = pkt_alloc();
+  ckpt_read(fp, packet, sizeof(struct pkt));
+  return packet;
+}
+
+static FILE *ckpt_fp;           /* file of ckpt_save_event() */
+static long ckpt_nqueued;       /* events counted by ckpt_count_event() */
+
+static void ckpt_count_event(struct event *e)
+{
+  ckpt_nqueued++;
+}
+
+/* the links are made again on restore */
+static void ckpt_save_event(struct event *e)
+{
+  ckpt_write(ckpt_fp, e, sizeof(struct event));
+  if (e->evtype == FROM_LAYER3)
+    ckpt_write_pkt(ckpt_fp, e->pktptr);
+}
+
+/* write the checkpoint next to the old one, then replace it, so that a */
+/* crash while writing leaves the old one intact                        */
+static void ckpt_save(void)
+{
+  struct ckpt_header hdr;
+  struct ckpt_state st;
+  char *tmp;
+  FILE *fp;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC));
+  hdr.version = CKPT_VERSION;
+  hdr.pktsize = sizeof(struct pkt);
+  hdr.evsize = sizeof(struct event);
+  hdr.nflows = nflows;
+  strncpy(hdr.checksum, checksum_name(), sizeof(hdr.checksum) - 1);
+
+  memset(&st, 0, sizeof(st));
+  st.time = time;
+  st.nsim = nsim;
+  st.naccepted = naccepted;
+  st.seed = seed;
+  st.nrand = nrand;
+  st.window_full = window_full;
+  st.total_ACKs_received = total_ACKs_received;
+  st.packets_resent = packets_resent;
+  st.new_ACKs = new_ACKs;
+  st.packets_received = packets_received;
+  st.packets_lost = packets_lost;
+  st.packets_corrupt = packets_corrupt;
+  st.packets_sent = packets_sent;
+  st.packets_timeout = packets_timeout;
+  st.messages_delivered = messages_delivered;
+  st.messages_skipped = messages_skipped;
+  st.ntolayer3 = ntolayer3;
+  st.nlost = nlost;
+  st.ncorrupt = ncorrupt;
+  st.nevents = nevents;
+  st.channel_last[A] = channel_last[A];
+  st.channel_last[B] = channel_last[B];
+  if (workload != NULL) {
+    st.workload = 1;
+    st.workload_offset = ftell(workload);
+    st.workload_lines = workload_lines;
+    st.workload_records = workload_records;
+    st.workload_bytes = workload_bytes;
+    st.workload_start = workload_start;
+    st.workload_when = workload_when;
+    st.workload_len = workload_len;
+    st.workload_flow = workload_flow;
+  }
+  st.trace_ring_next = trace_ring_next;
+  st.trace_ring_dumped = trace_ring_dumped;
+  st.sketches = sketches;
+  st.delays = delayqs != NULL;
+  st.win_width = win_width;
+  ckpt_nqueued = 0;
+  eventq_foreach(ckpt_count_event);
+  st.nqueued = ckpt_nqueued;
+
+  tmp = malloc(strlen(ckpt_path) + 5);
+  if (tmp == NULL) {
+    printf("memory allocation for checkpoint name failed.");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(tmp, "%s.tmp", ckpt_path);
+  fp = fopen(tmp, "wb");
+  if (fp == NULL) {
+    printf("cannot open checkpoint file %s\n", tmp);
+    exit(EXIT_FAILURE);
+  }
+  ckpt_write(fp, &hdr, sizeof(hdr));
+  ckpt_write(fp, &st, sizeof(st));
+  ckpt_write(fp, flows, nflows * sizeof(struct flow));
+  ckpt_write(fp, trace_ring, sizeof(trace_ring));
+  sketch_save(fp);
+  window_save(fp);
+  ckpt_fp = fp;
+  eventq_foreach(ckpt_save_event);
+  protocol_save(fp);
+  if (fclose(fp) != 0 || rename(tmp, ckpt_path) != 0) {
+    printf("cannot write checkpoint %s\n", ckpt_path);
+    exit(EXIT_FAILURE);
+  }
+  free(tmp);
+}
+
+/* called after init() and A_init()/B_init(): what they set up is replaced */
+static void ckpt_restore(void)
+{
+  struct ckpt_header hdr;
+  struct ckpt_state st;
+  struct event *e;
+  unsigned long n;
+  long i;
+  FILE *fp;
+
+  fp = fopen(restore_path, "rb");
+  if (fp == NULL) {
+    printf("cannot open checkpoint %s\n", restore_path);
+    exit(EXIT_FAILURE);
+  }
+  ckpt_read(fp, &hdr, sizeof(hdr));
+  if (memcmp(hdr.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC)) != 0 || hdr.version != CKPT_VERSION ||
+      hdr.pktsize != sizeof(struct pkt) || hdr.evsize != sizeof(struct event)) {
+    printf("%s is not a checkpoint of this emulator\n", restore_path);
+    exit(EXIT_FAILURE);
+  }
+  if (hdr.nflows != nflows) {
+    printf("checkpoint %s has %d flows, not %d\n", restore_path, hdr.nflows, nflows);
+    exit(EXIT_FAILURE);
+  }
+  if (strncmp(hdr.checksum, checksum_name(), sizeof(hdr.checksum)) != 0) {
+    printf("checkpoint %s uses the %s checksum, not %s\n", restore_path, hdr.checksum, checksum_name());
+    exit(EXIT_FAILURE);
+  }
+  ckpt_read(fp, &st, sizeof(st));
+  if (st.workload != (workload != NULL)) {
+    printf("checkpoint %s was made %s a workload file\n", restore_path, st.workload ? "with" : "without");
+    exit(EXIT_FAILURE);
+  }
+  if (st.sketches != sketches) {
+    printf("checkpoint %s was made %s -s\n", restore_path, st.sketches ? "with" : "without");
+    exit(EXIT_FAILURE);
+  }
+  if (st.delays != (delayqs != NULL)) {
+    printf("checkpoint %s was made %s the delays of replications (-r)\n", restore_path, st.delays ? "with" : "without");
+    exit(EXIT_FAILURE);
+  }
+  if (st.win_width != win_width) {
+    printf("checkpoint %s was made with windows of %g time units (-i), not %g\n", restore_path, st.win_width, win_width);
+    exit(EXIT_FAILURE);
+  }
+
+  /* drop the first arrivals scheduled by init() */
+  while ((e = eventq_pop()) != NULL) {
+    instr_queue(-1);
+    free(e);
+  }
+  eventq_reset();
+
+  time = st.time;
+  nsim = st.nsim;
+  naccepted = st.naccepted;
+  seed = st.seed;
+  srand(seed);
+  for (n = 0; n < st.nrand; n++)
+    rand();
+  nrand = st.nrand;
+  window_full = st.window_full;
+  total_ACKs_received = st.total_ACKs_received;
+  packets_resent = st.packets_resent;
+  new_ACKs = st.new_ACKs;
+  packets_received = st.packets_received;
+  packets_lost = st.packets_lost;
+  packets_corrupt = st.packets_corrupt;
+  packets_sent = st.packets_sent;
+  packets_timeout = st.packets_timeout;
+  messages_delivered = st.messages_delivered;
+  messages_skipped = st.messages_skipped;
+  ntolayer3 = st.ntolayer3;
+  nlost = st.nlost;
+  ncorrupt = st.ncorrupt;
+  nevents = st.nevents;
+  channel_last[A] = st.channel_last[A];
+  channel_last[B] = st.channel_last[B];
+  if (workload != NULL) {
+    if (fseek(workload, st.workload_offset, SEEK_SET) != 0) {
+      printf("cannot seek in the workload file\n");
+      exit(EXIT_FAILURE);
+    }
+    workload_lines = st.workload_lines;
+    workload_records = st.workload_records;
+    workload_bytes = st.workload_bytes;
+    workload_start = st.workload_start;
+    workload_when = st.workload_when;
+    workload_len = st.workload_len;
+    workload_flow = st.workload_flow;
+  }
+  trace_time = time;
+
+  ckpt_read(fp, flows, nflows * sizeof(struct flow));
+  for (i=0; i<nflows; i++)
+    flows[i].timer[A] = flows[i].timer[B] = NULL;
+  ckpt_read(fp, trace_ring, sizeof(trace_ring));
+  trace_ring_next = st.trace_ring_next;
+  trace_ring_dumped = st.trace_ring_dumped;
+  sketch_restore(fp);
+  window_restore(fp);
+
+  for (i=0; i<st.nqueued; i++) {
+    e = malloc(sizeof(struct event));
+    nallocs++;
+    if (e == NULL) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    ckpt_read(fp, e, sizeof(struct event));
+    if (e->evtype < TIMER_INTERRUPT || e->evtype > FROM_LAYER3 || (e->eventity != A && e->eventity != B) ||
+        e->evflow < 0 || e->evflow >= nflows) {
+      printf("checkpoint %s is corrupt\n", restore_path);
+      exit(EXIT_FAILURE);
+    }
+    e->pktptr = e->evtype == FROM_LAYER3 ? ckpt_read_pkt(fp) : NULL;
+    if (e->evtype == TIMER_INTERRUPT)
+      flows[e->evflow].timer[e->eventity] = e;
+    eventq_restore(e);
+    instr_queue(1);
+  }
+  protocol_restore(fp);
+  fclose(fp);
+}
+
+/************************** TIME WINDOWS ***************/
+/* With -i, the run is cut into windows of win_width time units.  For each
+   one, the messages delivered, the packets resent and the time average of
+   the messages outstanding (taken by A, not delivered yet) are kept.  At
+   the end the series is printed, or written to a CSV file, followed by the
+   steady state figures.  They leave out the windows after the last message
+   from layer 5, when the run only drains, and the start-up transient,
+   found with MSER-5 on the goodput of the windows. */
+
+#define MSER_BATCH 5        /* windows per batch mean */
+
+struct window {
+  int delivered;            /* messages delivered to layer 5 */
+  int resent;               /* packets resent by A */
+  double outstanding;       /* messages taken by A and not delivered, time average */
+};
+
+static struct window *windows = NULL;
+static int nwindows, win_size;
+static double win_origin;         /* start of the first window */
+static double win_start;          /* start of the open window */
+static double win_last;           /* outstanding is integrated up to here */
+static double win_area;           /* integral of outstanding over the open window */
+static int win_delivered, win_resent;  /* counters when the open window started */
+static double last_message;       /* time the last message came from layer 5 */
+
+static void window_init(void)
+{
+  win_origin = win_start = win_last = last_message = time;
+  win_area = 0.0;
+  win_delivered = messages_delivered;
+  win_resent = packets_resent;
+}
+
+/* the series so far and the open window go into checkpoints */
+static void window_save(FILE *fp)
+{
+  if (win_width <= 0.0)
+    return;
+  ckpt_write(fp, &nwindows, sizeof(nwindows));
+  if (nwindows > 0)
+    ckpt_write(fp, windows, nwindows * sizeof(struct window));
+  ckpt_write(fp, &win_origin, sizeof(win_origin));
+  ckpt_write(fp, &win_start, sizeof(win_start));
+  ckpt_write(fp, &win_last, sizeof(win_last));
+  ckpt_write(fp, &win_area, sizeof(win_area));
+  ckpt_write(fp, &win_delivered, sizeof(win_delivered));
+  ckpt_write(fp, &win_resent, sizeof(win_resent));
+  ckpt_write(fp, &last_message, sizeof(last_message));
+}
+
+static void window_restore(FILE *fp)
+{
+  if (win_width <= 0.0)
+    return;
+  ckpt_read(fp, &nwindows, sizeof(nwindows));
+  if (nwindows < 0) {
+    printf("checkpoint %s is corrupt\n", restore_path);
+    exit(EXIT_FAILURE);
+  }
+  free(windows);
+  win_size = nwindows > 256 ? nwindows : 256;
+  windows = malloc(win_size * sizeof(struct window));
+  if (windows == NULL) {
+    printf("memory allocation for windows failed.");
+    exit(EXIT_FAILURE);
+  }
+  if (nwindows > 0)
+    ckpt_read(fp, windows, nwindows * sizeof(struct window));
+  ckpt_read(fp, &win_origin, sizeof(win_origin));
+  ckpt_read(fp, &win_start, sizeof(win_start));
+  ckpt_read(fp, &win_last, sizeof(win_last));
+  ckpt_read(fp, &win_area, sizeof(win_area));
+  ckpt_read(fp, &win_delivered, sizeof(win_delivered));
+  ckpt_read(fp, &win_resent, sizeof(win_resent));
+  ckpt_read(fp, &last_message, sizeof(last_message));
+}
+
+static void window_close(double end)
+{
+  struct window *w;
+
+  if (nwindows == win_size) {
+    win_size = win_size ? 2 * win_size : 256;
+    windows = realloc(windows, win_size * sizeof(struct window));
+    if (windows == NULL) {
+      printf("memory allocation for windows failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  w = &windows[nwindows++];
+  w->delivered = messages_delivered - win_delivered;
+  w->resent = packets_resent - win_resent;
+  w->outstanding = end > win_start ? win_area / (end - win_start) : 0.0;
+  win_start = end;
+  win_area = 0.0;
+  win_delivered = messages_delivered;
+  win_resent = packets_resent;
+}
+
+/* close the windows that end by t, called before an event at t */
+static void window_advance(double t)
+{
+  double end;
+
+  while (t >= win_start + win_width) {
+    end = win_start + win_width;
+    win_area += (naccepted - messages_delivered - messages_skipped) * (end - win_last);
+    win_last = end;
+    window_close(end);
+  }
+  win_area += (naccepted - messages_delivered - messages_skipped) * (t - win_last);
+  win_last = t;
+}
+
+/* MSER-5: cut the first d batches of MSER_BATCH windows, with d chosen in
+   the first half of the run to minimise the variance estimate of the mean
+   of what is left, sum (b - mean)^2 / (k*k) over the k batch means b kept.
+   Returns the number of windows to cut. */
+static int mser5(int n)
+{
+  double sum = 0.0, sumsq = 0.0, b, v, best = 0.0;
+  int nb = n / MSER_BATCH, d, j, k, cut = 0;
+
+  if (nb < 2)
+    return 0;
+  for (d = nb - 1; d >= 0; d--) {
+    b = 0.0;
+    for (j = d * MSER_BATCH; j < (d + 1) * MSER_BATCH; j++)
+      b += windows[j].delivered;
+    b /= MSER_BATCH * win_width;
+    sum += b;
+    sumsq += b * b;
+    k = nb - d;
+    v = (sumsq - sum * sum / k) / ((double)k * k);
+    if (d <= nb / 2 && (d == nb / 2 || v <= best)) {
+      best = v;
+      cut = d;
+    }
+  }
+  return cut * MSER_BATCH;
+}
+
+static void print_windows(void)
+{
+  FILE *out = stdout;
+  double start, span;
+  long delivered = 0, resent = 0;
+  double outstanding = 0.0;
+  int i, steady, cut;
+
+  if (win_path != NULL) {
+    out = fopen(win_path, "w");
+    if (out == NULL) {
+      printf("cannot open %s\n", win_path);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(out, "start,end,delivered,goodput,resent,resend_rate,outstanding\n");
+  }
+  else
+    printf("time windows of %g time units:\n%12s %12s %10s %10s %11s\n", win_width,
+           "start", "end", "goodput", "resent/t", "outstanding");
+  for (i=0; i<nwindows; i++) {
+    start = win_origin + i * win_width;
+    span = i < nwindows - 1 ? win_width : time - start;   /* the last may be short */
+    if (span <= 0.0)
+      span = win_width;
+    if (win_path != NULL)
+      fprintf(out, "%f,%f,%d,%f,%d,%f,%f\n", start, start + span, windows[i].delivered,
+              windows[i].delivered / span, windows[i].resent, windows[i].resent / span,
+              windows[i].outstanding);
+    else
+      printf("%12.2f %12.2f %10.5f %10.5f %11.3f\n", start, start + span,
+             windows[i].delivered / span, windows[i].resent / span, windows[i].outstanding);
+  }
+  if (win_path != NULL)
+    fclose(out);
+
+  /* full windows that end by the last message from layer 5 */
+  steady = (int)((last_message - win_origin) / win_width);
+  if (steady > nwindows)
+    steady = nwindows;
+  cut = mser5(steady);
+  printf("steady state: MSER-5 cuts the first %d of %d windows (%g time units) as warm-up;\n",
+         cut, steady, cut * win_width);
+  printf("  %d windows after the last message from layer 5 at time %f are left out\n",
+         nwindows - steady, last_message);
+  if (steady - cut < 1) {
+    printf("  too few windows left for steady state figures\n");
+    return;
+  }
+  for (i=cut; i<steady; i++) {
+    delivered += windows[i].delivered;
+    resent += windows[i].resent;
+    outstanding += windows[i].outstanding;
+  }
+  span = (steady - cut) * win_width;
+  printf("  over %g time units: goodput %f messages per time unit, %f resends per time unit,\n",
+         span, delivered / span, resent / span);
+  printf("  %f messages outstanding on average\n", outstanding / (steady - cut));
+}
+
+/************************** REPLICATIONS ***************/
+/* With -r, the parameters are read once and the run is repeated with the
+   seeds seed, seed+1, ... in child processes, njobs at a time.  Each child
+   writes its counters down a pipe at the end; the parent folds them in
+   seed order into a running mean and variance (Welford), so the result
+   does not depend on which child finishes first, and prints 95%
+   confidence intervals.  With a target, no more replications are
+   started once every interval is within target*|mean| of its mean. */
+
+#define NMETRICS 3
+#define MIN_REPS 5          /* replications before stopping early */
+
+static const char *metric_names[NMETRICS] = {
+  "packets resent by A", "messages delivered", "mean delay (time units)"
+};
+
+struct rep_result {
+  int index;                /* replication, seed minus the first seed */
+  double value[NMETRICS];
+};
+
+struct welford {
+  long n;
+  double mean;
+  double m2;                /* sum of squared differences from the mean */
+};
+
+static void welford_add(struct welford *w, double x)
+{
+  double d = x - w->mean;
+
+  w->n++;
+  w->mean += d / w->n;
+  w->m2 += d * (x - w->mean);
+}
+
+/* two sided 95% quantile of Student's t with df degrees of freedom */
+static double t95(long df)
+{
+  static const double table[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+
+  if (df <= 30)
+    return table[df - 1];
+  return 1.959964 + 2.372272 / df;   /* first terms of the expansion in 1/df */
+}
+
+static double welford_halfwidth(const struct welford *w)
+{
+  if (w->n < 2)
+    return 0.0;
+  return t95(w->n - 1) * sqrt(w->m2 / (w->n - 1) / w->n);
+}
+
+static void replicate_report(void)
+{
+  struct rep_result r;
+
+  r.index = rep_index;
+  r.value[0] = packets_resent;
+  r.value[1] = messages_delivered;
+  r.value[2] = delay_n > 0 ? delay_sum / delay_n : 0.0;
+  if (write(rep_fd, &r, sizeof(r)) != sizeof(r))
+    exit(EXIT_FAILURE);
+}
+
+static void print_replications(struct welford *stats, int stopped)
+{
+  double hw, sd;
+  int k;
+
+  printf("\n%ld replications, seeds %u to %lu, %d at a time\n",
+         stats[0].n, seed, seed + stats[0].n - 1, njobs);
+  printf("%-26s %14s %14s   %s\n", "", "mean", "std dev", "95% confidence interval");
+  for (k=0; k<NMETRICS; k++) {
+    sd = stats[k].n > 1 ? sqrt(stats[k].m2 / (stats[k].n - 1)) : 0.0;
+    hw = welford_halfwidth(&stats[k]);
+    printf("%-26s %14.4f %14.4f   [%.4f, %.4f]\n", metric_names[k], stats[k].mean, sd,
+           stats[k].mean - hw, stats[k].mean + hw);
+  }
+  if (stopped)
+    printf("stopped early: every half-width is within %g%% of its mean\n", rep_target * 100);
+  else if (rep_target > 0.0)
+    printf("target half-width of %g%% not reached\n", rep_target * 100);
+}
+
+/* the parent never returns; each child returns to run one replication */
+static void replicate(void)
+{
+  struct welford stats[NMETRICS];
+  struct rep_result r, *results;
+  char *done;
+  pid_t *pids, pid;
+  int fds[2], next = 0, folded = 0, running = 0, stopped = 0, status, i, k;
+
+  if (njobs < 1)
+    njobs = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  results = malloc(nreps * sizeof(struct rep_result));
+  done = calloc(nreps, 1);
+  pids = calloc(nreps, sizeof(pid_t));
+  if (results == NULL || done == NULL || pids == NULL) {
+    printf("memory allocation for replications failed.");
+    exit(EXIT_FAILURE);
+  }
+  if (pipe(fds) < 0) {
+    printf("cannot create a pipe for the replications\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(stats, 0, sizeof(stats));
+  fflush(stdout);
+
+  while (folded < nreps && !stopped) {
+    while (running < njobs && next < nreps) {
+      pid = fork();
+      if (pid < 0) {
+        printf("cannot start replication %d\n", next);
+        exit(EXIT_FAILURE);
+      }
+      if (pid == 0) {
+        close(fds[0]);
+        rep_fd = fds[1];
+        rep_index = next;
+        seed += next;
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        return;
+      }
+      pids[next++] = pid;
+      running++;
+    }
+
+    pid = wait(&status);
+    running--;
+    for (i=0; i<next && pids[i] != pid; i++)
+      ;
+    pids[i] = 0;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      printf("replication with seed %u failed\n", seed + i);
+      exit(EXIT_FAILURE);
+    }
+    /* a child writes its result before it exits, so one is waiting */
+    if (read(fds[0], &r, sizeof(r)) != sizeof(r)) {
+      printf("lost the result of a replication\n");
+      exit(EXIT_FAILURE);
+    }
+    results[r.index] = r;
+    done[r.index] = 1;
+
+    while (folded < nreps && done[folded] && !stopped) {
+      for (k=0; k<NMETRICS; k++)
+        welford_add(&stats[k], results[folded].value[k]);
+      folded++;
+      if (rep_target > 0.0 && folded >= MIN_REPS) {
+        stopped = 1;
+        for (k=0; k<NMETRICS; k++)
+          if (welford_halfwidth(&stats[k]) > rep_target * fabs(stats[k].mean))
+            stopped = 0;
+      }
+    }
+  }
+
+  /* replications still running are not needed */
+  for (i=0; i<next; i++)
+    if (pids[i] != 0)
+      kill(pids[i], SIGKILL);
+  while (wait(NULL) > 0)
+    ;
+  print_replications(stats, stopped);
+  exit(EXIT_SUCCESS);
 }
 
-int main(void)
+/********************** COMMAND LINE OPTIONS ***********************/
+/* the simulation parameters are still read from stdin by init(); the */
+/* command line only switches on optional behaviour                   */
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [-a arrivals] [-b] [-C n:file] [-c sum|inet|crc32c] [-f flows]\n", prog);
+  printf("          [-i width[:file]] [-j jobs] [-q list|heap|calendar] [-R file] [-r reps[:target]]\n");
+  printf("          [-S seed] [-s] [-t tracefile] [-w workload]\n");
+  printf("  -a process  layer 5 arrivals: uniform (default), poisson, cbr,\n");
+  printf("              pareto[:alpha[:burst]] or mmpp[:ratio[:sojourn]]\n");
+  printf("  -b          print wall time, events/s, peak memory and allocations\n");
+  printf("  -C n:file   write a checkpoint to file every n messages\n");
+  printf("  -c kernel   checksum used by the protocol entities (default sum)\n");
+  printf("  -f flows    number of A/B pairs sharing the medium (default 1)\n");
+  printf("  -i w[:file] statistics per window of w time units, and steady state figures\n");
+  printf("              after the warm-up found by MSER-5; the series goes to file as CSV\n");
+  printf("  -j jobs     replications run at once (default one per cpu)\n");
+  printf("  -q queue    event queue for packets and messages (default list)\n");
+  printf("  -R file     start from a checkpoint written with -C\n");
+  printf("  -r n[:t]    run n replications with seeds seed..seed+n-1 and report 95%%\n");
+  printf("              confidence intervals; stop once all are within t*mean\n");
+  printf("  -s          delay percentiles and resends per packet, in constant memory\n");
+  printf("  -S seed     seed of the random number generator (default 9999)\n");
+  printf("  -t file     write a binary event trace, decode it with tracedump\n");
+  printf("  -w file     replay layer 5 arrivals from \"timestamp size [flow]\" records\n");
+  exit(EXIT_FAILURE);
+}
+
+static void parseargs(int argc, char **argv)
+{
+  int i;
+
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-a") == 0 && i+1 < argc) {
+      if (arrival_select(argv[++i]) < 0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-b") == 0)
+      bench = 1;
+    else if (strcmp(argv[i], "-C") == 0 && i+1 < argc) {
+      ckpt_every = atoi(argv[++i]);
+      ckpt_path = strchr(argv[i], ':');
+      if (ckpt_every < 1 || ckpt_path == NULL || *++ckpt_path == '\0')
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+      if (checksum_select(argv[++i]) < 0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-f") == 0 && i+1 < argc) {
+      nflows = atoi(argv[++i]);
+      if (nflows < 1)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-i") == 0 && i+1 < argc) {
+      win_width = atof(argv[++i]);
+      win_path = strchr(argv[i], ':');
+      if (win_path != NULL && *++win_path == '\0')
+        usage(argv[0]);
+      if (win_width <= 0.0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-j") == 0 && i+1 < argc) {
+      njobs = atoi(argv[++i]);
+      if (njobs < 1)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-q") == 0 && i+1 < argc) {
+      if (eventq_select(argv[++i]) < 0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-R") == 0 && i+1 < argc)
+      restore_path = argv[++i];
+    else if (strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+      nreps = atoi(argv[++i]);
+      if (strchr(argv[i], ':') != NULL) {
+        rep_target = atof(strchr(argv[i], ':') + 1);
+        if (rep_target <= 0.0)
+          usage(argv[0]);
+      }
+      if (nreps < 1)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-s") == 0)
+      sketches = 1;
+    else if (strcmp(argv[i], "-S") == 0 && i+1 < argc)
+      seed = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+      if (trace_open(argv[++i]) < 0) {
+        printf("cannot open trace file %s\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-w") == 0 && i+1 < argc) {
+      workload = fopen(argv[++i], "r");
+      if (workload == NULL) {
+        printf("cannot open workload file %s\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else
+      usage(argv[0]);
+  }
+  /* replications would share the files */
+  if (nreps > 0 && (ckpt_path != NULL || restore_path != NULL || trace_enabled)) {
+    printf("-r cannot be combined with -C, -R or -t\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* goodput of every flow, in messages delivered per time unit, and how
+   evenly it is shared (Jain's index: 1 if equal, 1/n if one flow has all) */
+static void print_flow_stats(void)
+{
+  double g, sum, sumsq, min, max;
+  int i;
+
+  printf("per flow statistics (goodput in messages delivered per time unit):\n");
+  printf("  flow      sent  delivered    goodput\n");
+  sum = sumsq = 0.0;
+  min = max = 0.0;
+  for (i=0; i<nflows; i++) {
+    g = time > 0.0 ? flows[i].delivered / time : 0.0;
+    if (i < FLOWS_LISTED)
+      printf("%6d %9d %10d %10.5f\n", i, flows[i].nsim, flows[i].delivered, g);
+    sum += g;
+    sumsq += g * g;
+    if (i == 0 || g < min)
+      min = g;
+    if (i == 0 || g > max)
+      max = g;
+  }
+  if (nflows > FLOWS_LISTED)
+    printf("  ... %d more flows\n", nflows - FLOWS_LISTED);
+  printf("goodput per flow: min %f, mean %f, max %f\n", min, sum / nflows, max);
+  printf("aggregate goodput: %f messages per time unit\n", sum);
+  printf("Jain's fairness index: %f\n", sumsq > 0.0 ? sum * sum / (nflows * sumsq) : 1.0);
+}
+
+static double wallclock(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* one line of key=value pairs, read by sr_bench.sh */
+static void print_bench_stats(double wall)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  printf("BENCH wall_s=%.3f events=%ld events_per_s=%.0f peak_rss_kb=%ld allocations=%ld\n",
+         wall, nevents, wall > 0.0 ? nevents / wall : 0.0, ru.ru_maxrss, nallocs);
+}
+
+int main(int argc, char **argv)
 {
   struct event *eventptr;
   struct msg  msg2give;
-  struct pkt  pkt2give;
+  struct flow *f;
+  double started;
    
-  int i,j;
+  int i,j,dropped;
   
+  parseargs(argc, argv);
   init();
-  A_init();
-  B_init();
+  for (current_flow=0; current_flow<nflows; current_flow++) {
+    A_init();
+    B_init();
+  }
+  current_flow = 0;
+  if (win_width > 0.0)
+    window_init();              /* a restore carries on with the saved windows */
+  if (restore_path != NULL)
+    ckpt_restore();
+  if (ckpt_path != NULL)
+    ckpt_next = (nsim / ckpt_every + 1) * ckpt_every;
+  started = wallclock();
    
   while (1) {
-    eventptr = evlist;            /* get next event to simulate */
+    if (ckpt_path != NULL && nsim >= ckpt_next) {
+      ckpt_save();
+      ckpt_next += ckpt_every;
+    }
+    eventptr = eventq_pop();      /* get next event to simulate */
     if (eventptr==NULL)
       goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
+    instr_queue(-1);
     if (TRACE>=2) {
       printf("\nEVENT time: %f,",eventptr->evtime);
       printf("  type: %d",eventptr->evtype);
@@ -417,16 +2013,35 @@ int main(void)
         printf(", fromlayer5 ");
       else
         printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
+      printf(" entity: %d",eventptr->eventity);
+      if (nflows > 1)
+        printf(" flow: %d",eventptr->evflow);
+      printf("\n");
     }
     time = eventptr->evtime;        /* update time to next event time */
+    if (win_width > 0.0)
+      window_advance(time);
+    nevents++;
+    instr_event(eventptr);
+    current_flow = eventptr->evflow;   /* entities below act for this flow */
+    f = &flows[current_flow];
+    trace_time = time;
+    trace_flow = current_flow;
+    TRACE_EVENT(TR_EVENT, eventptr->eventity, -1, -1, eventptr->evtype);
     if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
+      /* nsimmax messages per flow; with a workload, in total */
+      if (workload != NULL ? nsim < nsimmax : f->nsim < nsimmax) {
+        /* only one arrival is pending at a time, so workload_len still */
+        /* belongs to this message until the next one is generated     */
+        if (workload != NULL)
+          workload_payload(msg2give.data, nsim, workload_len);
+        generate_next_arrival(current_flow);   /* set up future arrival */
+        if (workload == NULL) {
+          /* fill in msg to give with string of same letter */    
+          j = f->nsim % 26; 
+          for (i=0; i<20; i++)  
+            msg2give.data[i] = 97 + j;
+        }
         if (TRACE>2) {
           printf("          MAINLOOP: data given to student: ");
           for (i=0; i<20; i++) 
@@ -434,31 +2049,43 @@ int main(void)
           printf("\n");
         }
         nsim++;
-        if (eventptr->eventity == A) 
+        f->nsim++;
+        last_message = time;
+        instr_start();
+        if (eventptr->eventity == A) {
+          dropped = window_full;
           A_output(msg2give);  
+          if (window_full == dropped) {
+            naccepted++;
+            if (delayqs != NULL)
+              delay_push(current_flow, time);
+          }
+        }
         else
           B_output(msg2give);  
+        instr_stop(eventptr);
       }
       else if (TRACE > 2)
           printf("          FROM_LAYER5: no more messages to send: \n");
     }
     else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
+      instr_start();
 	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+        A_input_ref(eventptr->pktptr);  /* appropriate entity */
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+        B_input_ref(eventptr->pktptr);
+      instr_stop(eventptr);
+	    pkt_release(eventptr->pktptr);   /* medium drops its reference */
     }
     else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+      f->timer[eventptr->eventity] = NULL;   /* timer is no longer pending */
+      packets_timeout++;
+      instr_start();
       if (eventptr->eventity == A) 
         A_timerinterrupt();
       else
         B_timerinterrupt();
+      instr_stop(eventptr);
     }
     else  {
       printf("INTERNAL PANIC: unknown event type \n");
@@ -474,5 +2101,24 @@ int main(void)
   printf("number of packet resends by A:  %d \n", packets_resent);
   printf("number of correct packets received at B:  %d \n", packets_received);
   printf("number of messages delivered to application:  %d \n", messages_delivered);
+  protocol_print_stats(stdout);
+  if (nflows > 1)
+    print_flow_stats();
+  if (sketches)
+    print_sketches();
+  if (win_width > 0.0) {
+    window_advance(time);
+    if (time > win_start)
+      window_close(time);
+    print_windows();
+  }
+  if (bench)
+    print_bench_stats(wallclock() - started);
+#ifdef INSTRUMENT
+  print_instr_stats();
+#endif
+  if (rep_fd >= 0)
+    replicate_report();
+  trace_close();
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
\ No newline at end of file
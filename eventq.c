@@ -0,0 +1,567 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "eventq.h"
+
+/* ******************************************************************
+   Event queue: a main queue plus a hashed timing wheel.  See eventq.h.
+
+   A timer sits in wheel slot tick % WHEEL_SLOTS, tick being its time in
+   units of WHEEL_TICK, until the queue reaches its tick; only then is it
+   moved into the main queue.  Timers stopped before that (most of them)
+   never touch the main queue.  wheel_cur is the first tick not yet
+   moved, so a timer is in the wheel exactly when its tick is at least
+   wheel_cur.
+
+   Every main queue orders events with before(), so all of them give the
+   same simulation.
+**********************************************************************/
+
+struct queue_impl {
+  const char *name;
+  void (*insert)(struct event *p);
+  void (*remove)(struct event *p);
+  struct event *(*first)(void);    /* earliest event, left in the queue */
+  void (*reset)(void);
+};
+
+int eventq_use_wheel = 1;
+
+static struct event *wheel[WHEEL_SLOTS];       /* unsorted timers of each slot */
+static long wheel_count = 0;                   /* timers in the wheel */
+static long wheel_cur = 0;                     /* first tick not moved to the main queue */
+static unsigned long evseq = 0;                /* events inserted so far */
+
+/* does a come out before b: earlier time, or same time and inserted later */
+static int before(const struct event *a, const struct event *b)
+{
+  return a->evtime < b->evtime || (a->evtime == b->evtime && a->evseq > b->evseq);
+}
+
+/********************* sorted list *************************/
+
+static struct event *evlist = NULL;            /* the event list */
+
+static void list_insert(struct event *p)
+{
+  struct event *q,*qold;
+
+  q = evlist;     /* q points to front of list in which p struct inserted */
+  if (q==NULL) {   /* list is empty */
+    evlist=p;
+    p->next=NULL;
+    p->prev=NULL;
+  }
+  else {
+    for (qold = q; q !=NULL && before(q, p); q=q->next)
+      qold=q;
+    if (q==NULL) {   /* end of list */
+      qold->next = p;
+      p->prev = qold;
+      p->next = NULL;
+    }
+    else if (q==evlist) { /* front of list */
+      p->next=evlist;
+      p->prev=NULL;
+      p->next->prev=p;
+      evlist = p;
+    }
+    else {     /* middle of list */
+      p->next=q;
+      p->prev=q->prev;
+      q->prev->next=p;
+      q->prev=p;
+    }
+  }
+}
+
+static void list_remove(struct event *q)
+{
+  if (q->next==NULL && q->prev==NULL)
+    evlist=NULL;         /* remove first and only event on list */
+  else if (q->next==NULL) /* end of list - there is one in front */
+    q->prev->next = NULL;
+  else if (q==evlist) { /* front of list - there must be event after */
+    q->next->prev=NULL;
+    evlist = q->next;
+  }
+  else {     /* middle of list */
+    q->next->prev = q->prev;
+    q->prev->next =  q->next;
+  }
+}
+
+static struct event *list_first(void)
+{
+  return evlist;
+}
+
+static void list_reset(void)
+{
+  evlist = NULL;
+}
+
+/********************* binary heap *************************/
+
+static struct event **heap = NULL;
+static long heap_size = 0;
+static long heap_cap = 0;
+
+static void heap_set(long i, struct event *p)
+{
+  heap[i] = p;
+  p->evpos = i;
+}
+
+static void heap_up(long i)
+{
+  struct event *p = heap[i];
+
+  while (i > 0 && before(p, heap[(i - 1) / 2])) {
+    heap_set(i, heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  heap_set(i, p);
+}
+
+static void heap_down(long i)
+{
+  struct event *p = heap[i];
+  long c;
+
+  for (;;) {
+    c = 2 * i + 1;
+    if (c >= heap_size)
+      break;
+    if (c + 1 < heap_size && before(heap[c + 1], heap[c]))
+      c++;
+    if (!before(heap[c], p))
+      break;
+    heap_set(i, heap[c]);
+    i = c;
+  }
+  heap_set(i, p);
+}
+
+static void heap_insert(struct event *p)
+{
+  if (heap_size == heap_cap) {
+    heap_cap = heap_cap ? 2 * heap_cap : 64;
+    heap = realloc(heap, heap_cap * sizeof(struct event *));
+    if (heap == NULL) {
+      printf("memory allocation for event heap failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  heap_set(heap_size++, p);
+  heap_up(heap_size - 1);
+}
+
+/* the last event takes the place of p and moves up or down from there */
+static void heap_remove(struct event *p)
+{
+  struct event *last;
+
+  if (p->evpos < --heap_size) {
+    last = heap[heap_size];
+    heap_set(p->evpos, last);
+    heap_up(last->evpos);
+    heap_down(last->evpos);
+  }
+}
+
+static struct event *heap_first(void)
+{
+  return heap_size > 0 ? heap[0] : NULL;
+}
+
+static void heap_reset(void)
+{
+  heap_size = 0;
+}
+
+/********************* calendar queue *************************/
+/* R. Brown, "Calendar queues", CACM 31(10), 1988.  Bucket b holds the
+   events whose time falls in a day of width cal_width congruent to b,
+   sorted.  The number of buckets follows the number of events, and on
+   every resize the width is set from the spacing of the next events.  */
+
+#define CAL_MIN_BUCKETS 2
+#define CAL_SAMPLE      25     /* events sampled to pick the bucket width */
+
+static struct event **cal = NULL;      /* the buckets */
+static long cal_buckets = 0;           /* power of two */
+static long cal_size = 0;              /* events in the calendar */
+static double cal_width = 1.0;         /* time covered by one bucket */
+static long cal_day = LONG_MAX;        /* no event is in an earlier day */
+static struct event *cal_min = NULL;   /* earliest event if cal_min_known */
+static int cal_min_known = 1;
+
+static long cal_dayof(float t)
+{
+  return (long)(t / cal_width);
+}
+
+static void cal_link(struct event *p)
+{
+  struct event **b, *q, *qold;
+  long day = cal_dayof(p->evtime);
+
+  b = &cal[day & (cal_buckets - 1)];
+  qold = NULL;
+  for (q = *b; q != NULL && before(q, p); q = q->next)
+    qold = q;
+  p->prev = qold;
+  p->next = q;
+  if (q != NULL)
+    q->prev = p;
+  if (qold != NULL)
+    qold->next = p;
+  else
+    *b = p;
+  cal_size++;
+  if (day < cal_day)
+    cal_day = day;
+  if (cal_min_known && (cal_min == NULL || before(p, cal_min)))
+    cal_min = p;
+}
+
+static void cal_unlink(struct event *p)
+{
+  if (p->prev != NULL)
+    p->prev->next = p->next;
+  else
+    cal[cal_dayof(p->evtime) & (cal_buckets - 1)] = p->next;
+  if (p->next != NULL)
+    p->next->prev = p->prev;
+  cal_size--;
+  if (p == cal_min)
+    cal_min_known = 0;
+}
+
+static struct event *cal_first(void)
+{
+  struct event *q;
+  long i, day;
+
+  if (cal_min_known)
+    return cal_min;
+  cal_min = NULL;
+  cal_min_known = 1;
+  if (cal_size == 0)
+    return NULL;
+  /* go through one year of days; a bucket head that falls on its day */
+  /* is the earliest event                                             */
+  for (i = 0, day = cal_day; i < cal_buckets; i++, day++) {
+    q = cal[day & (cal_buckets - 1)];
+    if (q != NULL && cal_dayof(q->evtime) <= day) {
+      cal_day = day;
+      return cal_min = q;
+    }
+  }
+  /* nothing within a year: look at every bucket */
+  for (i = 0; i < cal_buckets; i++)
+    if (cal[i] != NULL && (cal_min == NULL || before(cal[i], cal_min)))
+      cal_min = cal[i];
+  cal_day = cal_dayof(cal_min->evtime);
+  return cal_min;
+}
+
+/* rebuild with n buckets and a width of three times the mean spacing of */
+/* the next events, leaving out gaps more than twice the mean            */
+static void cal_resize(long n)
+{
+  struct event *sample[CAL_SAMPLE], *all, *q, *next;
+  double gap, sum;
+  long i, k, count;
+
+  k = cal_size < CAL_SAMPLE ? cal_size : CAL_SAMPLE;
+  for (i = 0; i < k; i++) {
+    sample[i] = cal_first();
+    cal_unlink(sample[i]);
+  }
+  if (k > 1) {
+    gap = (sample[k - 1]->evtime - sample[0]->evtime) / (k - 1);
+    sum = 0.0;
+    count = 0;
+    for (i = 1; i < k; i++)
+      if (sample[i]->evtime - sample[i - 1]->evtime <= 2 * gap) {
+        sum += sample[i]->evtime - sample[i - 1]->evtime;
+        count++;
+      }
+    if (sum > 0.0)
+      cal_width = 3 * sum / count;
+  }
+
+  all = NULL;
+  for (i = 0; i < cal_buckets; i++)
+    for (q = cal[i]; q != NULL; q = next) {
+      next = q->next;
+      q->next = all;
+      all = q;
+    }
+  free(cal);
+  cal = calloc(n, sizeof(struct event *));
+  if (cal == NULL) {
+    printf("memory allocation for calendar queue failed.");
+    exit(EXIT_FAILURE);
+  }
+  cal_buckets = n;
+  cal_size = 0;
+  cal_day = LONG_MAX;
+  cal_min = NULL;
+  cal_min_known = 1;
+  for (i = 0; i < k; i++)
+    cal_link(sample[i]);
+  for (q = all; q != NULL; q = next) {
+    next = q->next;
+    cal_link(q);
+  }
+}
+
+static void cal_insert(struct event *p)
+{
+  if (cal == NULL)
+    cal_resize(CAL_MIN_BUCKETS);
+  cal_link(p);
+  if (cal_size > 2 * cal_buckets)
+    cal_resize(2 * cal_buckets);
+}
+
+static void cal_remove(struct event *p)
+{
+  cal_unlink(p);
+  if (cal_size < cal_buckets / 2 && cal_buckets > CAL_MIN_BUCKETS)
+    cal_resize(cal_buckets / 2);
+}
+
+static void cal_reset(void)
+{
+  free(cal);
+  cal = NULL;
+  cal_buckets = 0;
+  cal_size = 0;
+  cal_width = 1.0;
+  cal_day = LONG_MAX;
+  cal_min = NULL;
+  cal_min_known = 1;
+}
+
+static struct queue_impl impls[] = {
+  { "list",     list_insert, list_remove, list_first, list_reset },
+  { "heap",     heap_insert, heap_remove, heap_first, heap_reset },
+  { "calendar", cal_insert,  cal_remove,  cal_first,  cal_reset },
+};
+
+static struct queue_impl *impl = &impls[0];
+
+int eventq_select(const char *name)
+{
+  unsigned int i;
+
+  for (i = 0; i < sizeof(impls)/sizeof(impls[0]); i++)
+    if (strcmp(impls[i].name, name) == 0) {
+      eventq_reset();
+      impl = &impls[i];
+      return 0;
+    }
+  return -1;
+}
+
+const char *eventq_name(void)
+{
+  return impl->name;
+}
+
+/********************* timer wheel *************************/
+
+static long wheel_tick(float t)
+{
+  return (long)(t / WHEEL_TICK);
+}
+
+static int in_wheel(const struct event *p)
+{
+  return eventq_use_wheel && p->evtype == TIMER_INTERRUPT && wheel_tick(p->evtime) >= wheel_cur;
+}
+
+static void wheel_insert(struct event *p)
+{
+  struct event **slot = &wheel[wheel_tick(p->evtime) & (WHEEL_SLOTS - 1)];
+
+  p->prev = NULL;
+  p->next = *slot;
+  if (*slot != NULL)
+    (*slot)->prev = p;
+  *slot = p;
+  wheel_count++;
+}
+
+static void wheel_remove(struct event *p)
+{
+  if (p->prev != NULL)
+    p->prev->next = p->next;
+  else
+    wheel[wheel_tick(p->evtime) & (WHEEL_SLOTS - 1)] = p->next;
+  if (p->next != NULL)
+    p->next->prev = p->prev;
+  wheel_count--;
+}
+
+/* move the timers of one tick from the wheel to the main queue */
+static void wheel_expire(long tick)
+{
+  struct event *q, *next;
+
+  for (q = wheel[tick & (WHEEL_SLOTS - 1)]; q != NULL; q = next) {
+    next = q->next;
+    if (wheel_tick(q->evtime) == tick) {
+      wheel_remove(q);
+      impl->insert(q);
+    }
+  }
+}
+
+/* earliest tick of any timer in the wheel */
+static long wheel_first_tick(void)
+{
+  struct event *q;
+  long tick, first;
+  int i;
+
+  first = -1;
+  for (i = 0; i < WHEEL_SLOTS; i++)
+    for (q = wheel[i]; q != NULL; q = q->next) {
+      tick = wheel_tick(q->evtime);
+      if (first < 0 || tick < first)
+        first = tick;
+    }
+  return first;
+}
+
+/* move every timer due no later than the head of the main queue into it */
+static void wheel_advance(void)
+{
+  struct event *head;
+  long idle = 0;    /* ticks walked while the main queue was empty */
+
+  while (wheel_count > 0) {
+    head = impl->first();
+    if (head != NULL && wheel_cur > wheel_tick(head->evtime))
+      break;
+    if (head == NULL && idle++ == WHEEL_SLOTS)
+      wheel_cur = wheel_first_tick();   /* next timer is more than a turn away */
+    wheel_expire(wheel_cur++);
+  }
+}
+
+/********************* interface *************************/
+
+void eventq_insert(struct event *p)
+{
+  p->evseq = ++evseq;
+  if (in_wheel(p))
+    wheel_insert(p);
+  else
+    impl->insert(p);
+}
+
+void eventq_remove(struct event *p)
+{
+  if (in_wheel(p))
+    wheel_remove(p);
+  else
+    impl->remove(p);
+}
+
+struct event *eventq_pop(void)
+{
+  struct event *p;
+
+  wheel_advance();
+  p = impl->first();
+  if (p == NULL)
+    return NULL;
+  impl->remove(p);        /* remove this event from event list */
+  if (wheel_count == 0 && wheel_cur <= wheel_tick(p->evtime))
+    wheel_cur = wheel_tick(p->evtime) + 1;   /* nothing to walk over */
+  return p;
+}
+
+/* the events themselves belong to the caller and are not freed */
+void eventq_reset(void)
+{
+  int i;
+
+  impl->reset();
+  for (i = 0; i < WHEEL_SLOTS; i++)
+    wheel[i] = NULL;
+  wheel_count = 0;
+  wheel_cur = 0;
+  evseq = 0;
+}
+
+void eventq_foreach(void (*fn)(struct event *))
+{
+  struct event *q, *next;
+  long i;
+
+  if (impl->first == list_first)
+    for (q = evlist; q != NULL; q = next) {
+      next = q->next;
+      fn(q);
+    }
+  else if (impl->first == heap_first)
+    for (i = 0; i < heap_size; i++)
+      fn(heap[i]);
+  else
+    for (i = 0; i < cal_buckets; i++)
+      for (q = cal[i]; q != NULL; q = next) {
+        next = q->next;
+        fn(q);
+      }
+  for (i = 0; i < WHEEL_SLOTS; i++)
+    for (q = wheel[i]; q != NULL; q = next) {
+      next = q->next;
+      fn(q);
+    }
+}
+
+/* restored timers go straight into the main queue, and wheel_cur moves */
+/* past them so that they are not looked for in the wheel               */
+void eventq_restore(struct event *p)
+{
+  if (p->evseq > evseq)
+    evseq = p->evseq;
+  if (eventq_use_wheel && p->evtype == TIMER_INTERRUPT && wheel_tick(p->evtime) >= wheel_cur)
+    wheel_cur = wheel_tick(p->evtime) + 1;
+  impl->insert(p);
+}
+
+static void print_event(const struct event *q, const char *where)
+{
+  printf("Event time: %f, type: %d entity: %d%s\n",q->evtime,q->evtype,q->eventity,where);
+}
+
+void eventq_print(void)
+{
+  struct event *q;
+  long i;
+
+  printf("--------------\nEvent List Follows:\n");
+  if (impl->first == list_first)
+    for(q = evlist; q!=NULL; q=q->next)
+      print_event(q, "");
+  else if (impl->first == heap_first)
+    for (i = 0; i < heap_size; i++)
+      print_event(heap[i], " (heap order)");
+  else
+    for (i = 0; i < cal_buckets; i++)
+      for (q = cal[i]; q != NULL; q = q->next)
+        print_event(q, " (calendar order)");
+  for (i = 0; i < WHEEL_SLOTS; i++)
+    for (q = wheel[i]; q != NULL; q = q->next)
+      print_event(q, " (timer wheel)");
+  printf("--------------\n");
+}
@@ -0,0 +1,56 @@
+/* ******************************************************************
+   Event queue of the emulator.
+
+   Packet arrivals and layer 5 messages are kept in the main queue: a
+   list sorted by time, the original structure and the default, a binary
+   heap, or a calendar queue whose bucket width adapts to the events
+   (eventq_select).  Timers are mostly stopped again before they go off
+   (every new ACK stops one), so they are kept apart in a hashed timing
+   wheel where starting and stopping a timer is O(1) whatever the number
+   of timers.
+
+   Events with the same time come out newest first, the order the sorted
+   list has always given them.
+**********************************************************************/
+
+/* possible events: */
+#define  TIMER_INTERRUPT 0
+#define  FROM_LAYER5     1
+#define  FROM_LAYER3     2
+
+struct pkt;
+
+struct event {
+  float evtime;           /* event time */
+  int evtype;             /* event type code */
+  int eventity;           /* entity where event occurs */
+  int evflow;             /* flow of the entity */
+  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
+  unsigned long evseq;    /* insertion order, breaks ties in evtime */
+  long evpos;             /* index in the heap */
+  struct event *prev;
+  struct event *next;
+};
+
+#define WHEEL_SLOTS 256   /* slots of the timer wheel, power of two */
+#define WHEEL_TICK  1.0   /* simulated time covered by one slot */
+
+extern int eventq_use_wheel;   /* 0: timers go in the main queue too */
+
+/* main queue "list", "heap" or "calendar"; -1 if unknown.  Only while */
+/* the queue is empty, e.g. before the first event or after a reset    */
+extern int eventq_select(const char *name);
+extern const char *eventq_name(void);
+
+extern void eventq_insert(struct event *p);
+extern void eventq_remove(struct event *p);   /* cancel a pending event */
+extern struct event *eventq_pop(void);       /* earliest event, NULL if none */
+extern void eventq_reset(void);              /* forget all events, back to time 0 */
+extern void eventq_print(void);
+
+/* checkpoints: visit every pending event, in no particular order (fn must */
+/* not change the queue), and put saved events back after eventq_reset().  */
+/* A restored event keeps its evseq, so events come out in the same order  */
+/* as in the run that saved them.                                         */
+extern void eventq_foreach(void (*fn)(struct event *));
+extern void eventq_restore(struct event *p);
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "eventq.h"
+
+/* ******************************************************************
+   Benchmarks of the emulator's event queue.
+
+   Build: gcc -O2 -o eventq_bench eventq_bench.c eventq.c
+   Usage: ./eventq_bench [events per measurement [largest pending set]]
+
+   Timers:
+
+   Each of T connections keeps one timer running, and PACKETS packets
+   are in flight.  Every packet arrival acts as an ACK: it stops the
+   timer of the next connection in turn, starts it again RTT ahead and
+   sends another packet.  Packets are spaced so that each timer is
+   restarted about twice per RTT, so, as in sr.c, nearly every timer is
+   stopped before it goes off.  Event throughput is reported with timers
+   in the timing wheel and, up to LIST_MAX timers, in the sorted list.
+
+   Main queue:
+   The classic hold model: N events are pending, and each step takes the
+   earliest one and schedules it again a random time ahead (uniform, with
+   64 events per time unit on average).  Holds per second are reported
+   for the sorted list (up to LIST_MAX events), the binary heap and the
+   calendar queue, for N from 10 up to 10^7.
+**********************************************************************/
+
+#define DEFAULT_EVENTS 1000000
+#define PACKETS  64          /* packet events in flight */
+#define RTT      16.0
+#define LIST_MAX 10000       /* larger runs take too long with the list */
+#define LIST_BUDGET 100000000.0  /* list: holds times pending events per run */
+#define DEFAULT_PENDING 10000000
+
+static unsigned int seed = 9999;
+static float now;           /* simulated time */
+
+static double uniform(void)
+{
+  seed ^= seed << 13;        /* xorshift32 */
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed / 4294967296.0;
+}
+
+static double wallclock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* events per second with ntimers timers running */
+static double run(long ntimers, long nevents)
+{
+  struct event *timers, *packets, *e;
+  long i, c;
+  double t0, t1, transit;
+
+  timers = calloc(ntimers, sizeof(struct event));
+  packets = calloc(PACKETS, sizeof(struct event));
+  if (timers == NULL || packets == NULL) {
+    printf("memory allocation for events failed.");
+    exit(EXIT_FAILURE);
+  }
+  eventq_reset();
+  now = 0.0;
+  /* timer i is first restarted around (i/ntimers)*RTT/2; start it so */
+  /* that it would only go off after that                             */
+  for (i = 0; i < ntimers; i++) {
+    timers[i].evtype = TIMER_INTERRUPT;
+    timers[i].evflow = i;
+    timers[i].evtime = now + RTT * (1.0 + (double)i / ntimers) / 2;
+    eventq_insert(&timers[i]);
+  }
+  /* ntimers arrivals should take RTT/2 with PACKETS in flight */
+  transit = RTT * PACKETS / ntimers;
+  for (i = 0; i < PACKETS; i++) {
+    packets[i].evtype = FROM_LAYER3;
+    packets[i].evtime = now + transit * uniform();
+    eventq_insert(&packets[i]);
+  }
+
+  c = 0;
+  t0 = wallclock();
+  for (i = 0; i < nevents; i++) {
+    e = eventq_pop();
+    now = e->evtime;
+    if (e->evtype == FROM_LAYER3) {
+      eventq_remove(&timers[c]);
+      timers[c].evtime = now + RTT;
+      eventq_insert(&timers[c]);
+      c = (c + 1) % ntimers;
+      e->evtime = now + transit * uniform();
+    }
+    else
+      e->evtime = now + RTT;
+    eventq_insert(e);
+  }
+  t1 = wallclock();
+
+  eventq_reset();
+  free(timers);
+  free(packets);
+  return nevents / (t1 - t0);
+}
+
+/* holds per second of one main queue with npending events */
+static double hold(const char *queue, long npending, long nholds)
+{
+  struct event *events, *e;
+  double mean, t0, t1;
+  long i;
+
+  events = calloc(npending, sizeof(struct event));
+  if (events == NULL) {
+    printf("memory allocation for events failed.");
+    exit(EXIT_FAILURE);
+  }
+  eventq_select(queue);
+  now = 0.0;
+  mean = npending / 64.0;
+  for (i = 0; i < npending; i++) {
+    events[i].evtype = FROM_LAYER3;
+    events[i].evtime = now + 2 * mean * uniform();
+    eventq_insert(&events[i]);
+  }
+
+  t0 = wallclock();
+  for (i = 0; i < nholds; i++) {
+    e = eventq_pop();
+    now = e->evtime;
+    e->evtime = now + 2 * mean * uniform();
+    eventq_insert(e);
+  }
+  t1 = wallclock();
+
+  eventq_reset();
+  free(events);
+  return nholds / (t1 - t0);
+}
+
+int main(int argc, char **argv)
+{
+  static const long counts[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+  long nevents = DEFAULT_EVENTS;
+  long maxpending = DEFAULT_PENDING;
+  long n, nholds;
+  unsigned int i;
+
+  if (argc > 1)
+    nevents = atol(argv[1]);
+  if (argc > 2)
+    maxpending = atol(argv[2]);
+  if (nevents < 1 || maxpending < 10) {
+    printf("usage: %s [events per measurement [largest pending set]]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%10s %14s %14s   (events per second)\n", "timers", "wheel", "list");
+  for (i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+    printf("%10ld", counts[i]);
+    eventq_use_wheel = 1;
+    printf(" %14.0f", run(counts[i], nevents));
+    if (counts[i] <= LIST_MAX) {
+      eventq_use_wheel = 0;
+      printf(" %14.0f\n", run(counts[i], nevents));
+    }
+    else
+      printf(" %14s\n", "-");
+    fflush(stdout);
+  }
+
+  printf("\n%10s %14s %14s %14s   (holds per second)\n", "pending", "list", "heap", "calendar");
+  for (n = 10; n <= maxpending; n *= 10) {
+    printf("%10ld", n);
+    if (n <= LIST_MAX) {
+      nholds = LIST_BUDGET / n < nevents ? (long)(LIST_BUDGET / n) : nevents;
+      printf(" %14.0f", hold("list", n, nholds));
+    }
+    else
+      printf(" %14s", "-");
+    printf(" %14.0f", hold("heap", n, nevents));
+    printf(" %14.0f\n", hold("calendar", n, nevents));
+    fflush(stdout);
+  }
+  return EXIT_SUCCESS;
+}
@@ -1,3 +1,5 @@
+#include <stdio.h>   /* FILE, for checkpoints */
+
 extern int TRACE;
 
 /* statistics updated by GBN */
@@ -10,6 +12,12 @@ extern int window_full; /* count of the number of messages dropped due to full w
 #define   A    0
 #define   B    1
 
+/* flows: nflows independent A/B pairs share the medium.  The entity
+   routines are called with current_flow set to the flow they act for,
+   and keep their state per flow; A_init() and B_init() run once per flow. */
+extern int nflows;
+extern int current_flow;
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
@@ -30,11 +38,40 @@ struct pkt {
 /* send to A or B (int), packet to send */
 extern void tolayer3(int, struct pkt);  
 
+/* zero-copy packet API.  Packets live in a pool owned by the emulator and
+   are passed around by handle, so a packet is written once by the sender.
+   pkt_alloc() returns a handle holding one reference; every holder that
+   keeps a packet beyond the current call takes its own reference. */
+extern struct pkt *pkt_alloc(void);
+extern void pkt_hold(struct pkt *);
+extern void pkt_release(struct pkt *);
+
+/* send to A or B (int), packet handle; layer 3 takes its own reference */
+extern void tolayer3_ref(int, struct pkt *);
+
+/* checkpoints (-C, -R).  protocol_save() writes the protocol state with
+   these and protocol_restore() reads it back in the same order; both exit
+   on an I/O error.  Packets are saved by value, so a handle shared by
+   several holders comes back as one packet per holder. */
+extern void ckpt_write(FILE *, const void *, size_t);
+extern void ckpt_read(FILE *, void *, size_t);
+extern void ckpt_write_pkt(FILE *, const struct pkt *);   /* NULL allowed */
+extern struct pkt *ckpt_read_pkt(FILE *);   /* new handle with one reference, or NULL */
+
+/* a sender reports the resends of each packet once it is acknowledged */
+extern void record_resends(int);
+
 /* deliver to A or B (int), data to deliver */
 extern void tolayer5(int, char[20]); 
 
+/* A or B (int) passes over a message it will never deliver */
+extern void tolayer5_skip(int);
+
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(int);
+
+/* current time, in the time units of starttimer() */
+extern double get_sim_time(void);               
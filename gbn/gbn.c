@@ -1,8 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "emulator.h"
+#include "checksum.h"
+#include "trace.h"
 #include "gbn.h"
+#include "seqnum.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -23,8 +27,18 @@
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#ifndef WINDOWSIZE
 #define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
+#endif
+#ifndef GBN_CACHE
+#define GBN_CACHE 0     /* out-of-order packets B may keep, 0 for classic GBN */
+#endif
+#if GBN_CACHE < 0 || GBN_CACHE >= WINDOWSIZE
+#error "GBN_CACHE must be from 0 to WINDOWSIZE-1"
+#endif
+/* the min sequence space for GBN must be at least windowsize + 1, and B */
+/* must also tell the packets it caches from old ones sent again         */
+#define SEQSPACE (WINDOWSIZE + 1 + GBN_CACHE)
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
@@ -32,22 +46,15 @@
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+int ComputeChecksum(const struct pkt *packet)
 {
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
+  /* kernel (byte sum, Internet checksum or CRC32C) is chosen with -c */
+  return pkt_checksum(packet);
 }
 
-bool IsCorrupted(struct pkt packet)
+bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
@@ -56,51 +63,62 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+/* sender state of one flow */
+struct sender {
+  struct pkt *buffer[WINDOWSIZE]; /* handles of packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int A_nextseqnum;               /* the next sequence number to be used by the sender */
+};
+
+static struct sender *senders = NULL;   /* one per flow, indexed by current_flow */
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
 void A_output(struct msg message)
 {
-  struct pkt sendpkt;
+  struct sender *s = &senders[current_flow];
+  struct pkt *sendpkt;
   int i;
 
   /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+  if ( s->windowcount < WINDOWSIZE) {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
+    sendpkt = pkt_alloc();
+    sendpkt->seqnum = s->A_nextseqnum;
+    sendpkt->acknum = NOTINUSE;
     for ( i=0; i<20 ; i++ ) 
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt); 
+      sendpkt->payload[i] = message.data[i];
+    sendpkt->checksum = ComputeChecksum(sendpkt); 
 
     /* put packet in window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
-    windowcount++;
+    s->windowlast = (s->windowlast + 1) % WINDOWSIZE; 
+    if (s->buffer[s->windowlast] != NULL)
+      pkt_release(s->buffer[s->windowlast]);   /* slot held an already ACKed packet */
+    s->buffer[s->windowlast] = sendpkt;
+    s->windowcount++;
 
     /* send out packet */
     if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+      printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+    TRACE_EVENT(TR_SEND, A, sendpkt->seqnum, NOTINUSE, 0);
+    tolayer3_ref (A, sendpkt);
 
     /* start timer if first packet in window */
-    if (windowcount == 1)
+    if (s->windowcount == 1)
       starttimer(A,RTT);
 
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
+    s->A_nextseqnum = SEQ_NEXT(s->A_nextseqnum);  
   }
   /* if blocked,  window is full */
   else {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
+    TRACE_EVENT(TR_WINDOW_FULL, A, -1, -1, 0);
     window_full++;
   }
 }
@@ -109,73 +127,99 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4 
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+void A_input_ref(struct pkt *packet)
 {
+  struct sender *s = &senders[current_flow];
   int ackcount = 0;
   int i;
 
   /* if received ACK is not corrupted */ 
   if (!IsCorrupted(packet)) {
     if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
+      printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
     total_ACKs_received++;
 
     /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
-          /* check case when seqnum has and hasn't wrapped */
-          if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-              ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
+    if (s->windowcount != 0) {
+          int seqfirst = s->buffer[s->windowfirst]->seqnum;
+          int seqlast = s->buffer[s->windowlast]->seqnum;
+          /* distances from the first packet, wrap included */
+          if (SEQ_DIST(packet->acknum, seqfirst) <= SEQ_DIST(seqlast, seqfirst)) {
 
             /* packet is a new ACK */
             if (TRACE > 0)
-              printf("----A: ACK %d is not a duplicate\n",packet.acknum);
+              printf("----A: ACK %d is not a duplicate\n",packet->acknum);
+            TRACE_EVENT(TR_ACK, A, -1, packet->acknum, 0);
             new_ACKs++;
 
             /* cumulative acknowledgement - determine how many packets are ACKed */
-            if (packet.acknum >= seqfirst)
-              ackcount = packet.acknum + 1 - seqfirst;
+#ifdef SEQ32
+            ackcount = SEQ_DIST(packet->acknum, seqfirst) + 1;
+#else
+            /* one short across the wrap, kept so that runs stay as they were */
+            if (packet->acknum >= seqfirst)
+              ackcount = packet->acknum + 1 - seqfirst;
             else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
+              ackcount = SEQSPACE - seqfirst + packet->acknum;
+#endif
 
 	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+            s->windowfirst = (s->windowfirst + ackcount) % WINDOWSIZE;
 
             /* delete the acked packets from window buffer */
             for (i=0; i<ackcount; i++)
-              windowcount--;
+              s->windowcount--;
 
 	    /* start timer again if there are still more unacked packets in window */
             stoptimer(A);
-            if (windowcount > 0)
+            if (s->windowcount > 0)
               starttimer(A, RTT);
 
           }
+          else
+            TRACE_EVENT(TR_ACK, A, -1, packet->acknum, TRF_DUP);
         }
-        else
+        else {
           if (TRACE > 0)
-        printf ("----A: duplicate ACK received, do nothing!\n");
+            printf ("----A: duplicate ACK received, do nothing!\n");
+          TRACE_EVENT(TR_ACK, A, -1, packet->acknum, TRF_DUP);
+        }
   }
-  else 
+  else {
     if (TRACE > 0)
       printf ("----A: corrupted ACK is received, do nothing!\n");
+    TRACE_EVENT(TR_ACK_CORRUPT, A, -1, -1, 0);
+  }
+}
+
+/* by-value entry point kept for compatibility */
+void A_input(struct pkt packet)
+{
+  struct pkt *p;
+
+  p = pkt_alloc();
+  *p = packet;
+  A_input_ref(p);
+  pkt_release(p);
 }
 
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
+  struct sender *s = &senders[current_flow];
   int i;
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
+  TRACE_EVENT(TR_TIMEOUT, A, s->windowcount > 0 ? s->buffer[s->windowfirst]->seqnum : -1, -1, 0);
 
-  for(i=0; i<windowcount; i++) {
+  for(i=0; i<s->windowcount; i++) {
 
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", s->buffer[(s->windowfirst+i) % WINDOWSIZE]->seqnum);
+    TRACE_EVENT(TR_RESEND, A, s->buffer[(s->windowfirst+i) % WINDOWSIZE]->seqnum, -1, 0);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
+    tolayer3_ref(A,s->buffer[(s->windowfirst+i) % WINDOWSIZE]);
     packets_resent++;
     if (i==0) starttimer(A,RTT);
   }
@@ -183,80 +227,311 @@ void A_timerinterrupt(void)
 
 
 
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
+/* the following routine will be called once (only) for each flow, with */
+/* current_flow set, before any other entity A routines are called. You  */
+/* can use it to do any initialization */
 void A_init(void)
 {
+  struct sender *s;
+  int i;
+
+  if (senders == NULL) {
+    senders = malloc(nflows * sizeof(struct sender));
+    if (senders == NULL) {
+      printf("memory allocation for sender state failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s = &senders[current_flow];
+
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
+  s->A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  s->windowfirst = 0;
+  s->windowlast = -1;   /* windowlast is where the last packet sent is stored.  
 		     new packets are placed in winlast + 1 
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
+  s->windowcount = 0;
+  for (i = 0; i < WINDOWSIZE; i++)
+    s->buffer[i] = NULL;
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+/* receiver state of one flow.  Built with -DGBN_CACHE=n, B keeps up to n
+   packets that arrive ahead of expectedseqnum, and delivers them as soon
+   as the gap before them is filled; its ACKs still carry the highest
+   sequence number received in order, so A is unchanged.  cache[] is a
+   ring: slot (cachehead + k) % GBN_CACHE holds expectedseqnum + 1 + k. */
+struct receiver {
+  int expectedseqnum; /* the sequence number expected next by the receiver */
+  int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+#if GBN_CACHE > 0
+  struct pkt *cache[GBN_CACHE];   /* handles of the packets kept, or NULL */
+  int cachehead;                  /* slot of expectedseqnum + 1 */
+#endif
+};
+
+static struct receiver *receivers = NULL;   /* one per flow, indexed by current_flow */
+
+#if GBN_CACHE > 0
+static int cache_held;    /* packets in the caches of all flows */
+static int cache_peak;    /* most packets held at once */
+static int packets_cached;  /* out-of-order packets kept, delivered once the gap is filled */
+
+/* deliver the packet expected next and slide the cache by one; returns */
+/* the cached packet expected now, or NULL                               */
+static struct pkt *deliver_in_order(struct receiver *r, struct pkt *packet)
+{
+  struct pkt *next;
+
+  tolayer5(B, packet->payload);
+  r->expectedseqnum = SEQ_NEXT(r->expectedseqnum);
+  next = r->cache[r->cachehead];
+  r->cache[r->cachehead] = NULL;   /* now the slot of expectedseqnum + GBN_CACHE */
+  r->cachehead = (r->cachehead + 1) % GBN_CACHE;
+  return next;
+}
+
+/* keep a packet that arrived ahead of the one expected */
+static void cache_packet(struct receiver *r, struct pkt *packet)
+{
+  int slot;
+
+  slot = (r->cachehead + SEQ_DIST(packet->seqnum, r->expectedseqnum) - 1) % GBN_CACHE;
+  if (r->cache[slot] != NULL)
+    return;     /* a copy is kept already */
+  pkt_hold(packet);
+  r->cache[slot] = packet;
+  packets_cached++;
+  if (++cache_held > cache_peak)
+    cache_peak = cache_held;
+  if (TRACE > 0)
+    printf("----B: packet %d is out of order, cached\n", packet->seqnum);
+}
+#endif
 
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+void B_input_ref(struct pkt *packet)
 {
-  struct pkt sendpkt;
+  struct receiver *r = &receivers[current_flow];
+  struct pkt *sendpkt;
+#if GBN_CACHE > 0
+  struct pkt *cached, *next;
+#endif
   int i;
+  bool corrupted;
+
+  sendpkt = pkt_alloc();
+  corrupted = IsCorrupted(packet);
 
   /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  if  ( (!corrupted)  && (packet->seqnum == r->expectedseqnum) ) {
     if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
+      printf("----B: packet %d is correctly received, send ACK!\n",packet->seqnum);
     packets_received++;
 
+#if GBN_CACHE > 0
+    /* deliver it and the cached packets that follow it */
+    cached = deliver_in_order(r, packet);
+    while (cached != NULL) {
+      packets_received++;
+      next = deliver_in_order(r, cached);
+      pkt_release(cached);
+      cache_held--;
+      cached = next;
+    }
+
+    /* ACK the highest sequence number received in order */
+    sendpkt->acknum = SEQ_PREV(r->expectedseqnum);
+    TRACE_EVENT(TR_RECV, B, packet->seqnum, sendpkt->acknum, 0);
+#else
     /* deliver to receiving application */
-    tolayer5(B, packet.payload);
+    tolayer5(B, packet->payload);
 
     /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    sendpkt->acknum = r->expectedseqnum;
+    TRACE_EVENT(TR_RECV, B, packet->seqnum, sendpkt->acknum, 0);
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;        
+    r->expectedseqnum = SEQ_NEXT(r->expectedseqnum);        
+#endif
   }
   else {
+#if GBN_CACHE > 0
+    if (!corrupted && SEQ_DIST(packet->seqnum, r->expectedseqnum) <= GBN_CACHE)
+      cache_packet(r, packet);
+#endif
     /* packet is corrupted or out of order resend last ACK */
     if (TRACE > 0) 
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
-    else
-      sendpkt.acknum = expectedseqnum - 1;
+    sendpkt->acknum = SEQ_PREV(r->expectedseqnum);
+    TRACE_EVENT(corrupted ? TR_RECV_CORRUPT : TR_RECV, B, packet->seqnum, sendpkt->acknum, TRF_DUP);
   }
 
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+  sendpkt->seqnum = r->B_nextseqnum;
+  r->B_nextseqnum = (r->B_nextseqnum + 1) % 2;
     
   /* we don't have any data to send.  fill payload with 0's */
   for ( i=0; i<20 ; i++ ) 
-    sendpkt.payload[i] = '0';  
+    sendpkt->payload[i] = '0';  
 
   /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt); 
+  sendpkt->checksum = ComputeChecksum(sendpkt); 
 
   /* send out packet */
-  tolayer3 (B, sendpkt);
+  tolayer3_ref (B, sendpkt);
+  pkt_release(sendpkt);
 }
 
-/* the following routine will be called once (only) before any other */
-/* entity B routines are called. You can use it to do any initialization */
+/* by-value entry point kept for compatibility */
+void B_input(struct pkt packet)
+{
+  struct pkt *p;
+
+  p = pkt_alloc();
+  *p = packet;
+  B_input_ref(p);
+  pkt_release(p);
+}
+
+/* the following routine will be called once (only) for each flow, with */
+/* current_flow set, before any other entity B routines are called. You  */
+/* can use it to do any initialization */
 void B_init(void)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  struct receiver *r;
+#if GBN_CACHE > 0
+  int i;
+#endif
+
+  if (receivers == NULL) {
+    receivers = malloc(nflows * sizeof(struct receiver));
+    if (receivers == NULL) {
+      printf("memory allocation for receiver state failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  r = &receivers[current_flow];
+  r->expectedseqnum = 0;
+  r->B_nextseqnum = 1;
+#if GBN_CACHE > 0
+  for (i = 0; i < GBN_CACHE; i++)
+    r->cache[i] = NULL;
+  r->cachehead = 0;
+#endif
+}
+
+/********* checkpoints ************/
+
+static const char ckpt_tag[4] = "GBN";
+
+/* the build a checkpoint was made with, written after the tag: the state
+   is saved as it lies in memory, so it only fits the same build */
+struct ckpt_build {
+  unsigned int sender_size, receiver_size;   /* sizeof of the per flow state */
+  int windowsize, seq32, cache;
+};
+
+static void ckpt_this_build(struct ckpt_build *b)
+{
+  memset(b, 0, sizeof(*b));
+  b->sender_size = sizeof(struct sender);
+  b->receiver_size = sizeof(struct receiver);
+  b->windowsize = WINDOWSIZE;
+#ifdef SEQ32
+  b->seq32 = 1;
+#endif
+  b->cache = GBN_CACHE;
+}
+
+static void ckpt_print_build(const char *which, const struct ckpt_build *b)
+{
+  printf("  %s: WINDOWSIZE=%d%s GBN_CACHE=%d, state %u + %u bytes per flow\n",
+         which, b->windowsize, b->seq32 ? " SEQ32" : "", b->cache,
+         b->sender_size, b->receiver_size);
+}
+
+/* the buffers are saved as the packets in them */
+void protocol_save(FILE *fp)
+{
+  struct ckpt_build build;
+  int i, j;
+
+  ckpt_write(fp, ckpt_tag, sizeof(ckpt_tag));
+  ckpt_this_build(&build);
+  ckpt_write(fp, &build, sizeof(build));
+  for (i = 0; i < nflows; i++) {
+    ckpt_write(fp, &senders[i], sizeof(struct sender));
+    for (j = 0; j < WINDOWSIZE; j++)
+      ckpt_write_pkt(fp, senders[i].buffer[j]);
+    ckpt_write(fp, &receivers[i], sizeof(struct receiver));
+#if GBN_CACHE > 0
+    for (j = 0; j < GBN_CACHE; j++)
+      ckpt_write_pkt(fp, receivers[i].cache[j]);
+#endif
+  }
+#if GBN_CACHE > 0
+  ckpt_write(fp, &cache_peak, sizeof(cache_peak));
+  ckpt_write(fp, &packets_cached, sizeof(packets_cached));
+#endif
+}
+
+void protocol_restore(FILE *fp)
+{
+  char tag[sizeof(ckpt_tag)];
+  struct ckpt_build saved, build;
+  int i, j;
+
+  ckpt_read(fp, tag, sizeof(tag));
+  if (memcmp(tag, ckpt_tag, sizeof(tag)) != 0) {
+    printf("checkpoint was not made with GBN\n");
+    exit(EXIT_FAILURE);
+  }
+  ckpt_read(fp, &saved, sizeof(saved));
+  ckpt_this_build(&build);
+  if (memcmp(&saved, &build, sizeof(build)) != 0) {
+    printf("checkpoint was made with GBN built with other options\n");
+    ckpt_print_build("checkpoint", &saved);
+    ckpt_print_build("this build", &build);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nflows; i++) {
+    ckpt_read(fp, &senders[i], sizeof(struct sender));
+    for (j = 0; j < WINDOWSIZE; j++)
+      senders[i].buffer[j] = ckpt_read_pkt(fp);
+    ckpt_read(fp, &receivers[i], sizeof(struct receiver));
+#if GBN_CACHE > 0
+    for (j = 0; j < GBN_CACHE; j++)
+      if ((receivers[i].cache[j] = ckpt_read_pkt(fp)) != NULL)
+        cache_held++;
+#endif
+  }
+#if GBN_CACHE > 0
+  ckpt_read(fp, &cache_peak, sizeof(cache_peak));
+  ckpt_read(fp, &packets_cached, sizeof(packets_cached));
+#endif
+}
+
+/********* statistics ************/
+
+/* memory and use of the out-of-order cache: the slots are packet handles,
+   and the bytes held are those of the packets, without the reference
+   count and link of the pool buffers they are in */
+void protocol_print_stats(FILE *fp)
+{
+#if GBN_CACHE > 0
+  int slots = nflows * GBN_CACHE;
+
+  fprintf(fp, "out-of-order cache at B: %d slots (%lu bytes), at most %d packets held (%lu bytes)\n",
+          slots, (unsigned long)(slots * sizeof(struct pkt *)),
+          cache_peak, (unsigned long)(cache_peak * sizeof(struct pkt)));
+  fprintf(fp, "number of out-of-order packets cached at B:  %d \n", packets_cached);
+#endif
 }
 
 /******************************************************************************
@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# Classic GBN against GBN with an out-of-order cache at the receiver.
+#
+# Usage: ./gbn_cache.sh [cache size [seed]]
+#
+# GBN is built twice, as it is and with -DGBN_CACHE=n (default 3, at most
+# WINDOWSIZE-1), and both run every scenario below with the same seed
+# (default 9999), so the medium draws from the same random stream.  For
+# each run the goodput (messages delivered per time unit), the resends by
+# A and the packets delivered from the cache are printed, with the memory
+# the cache costs: its slots (packet handles) and, at the peak, the pool
+# buffers of the packets it held.
+
+CACHE=${1:-3}
+SEED=${2:-9999}
+OUT=bench_results
+
+mkdir -p $OUT
+(cd gbn && gcc -O2 -I.. -o ../$OUT/gbn gbn.c emulator.c ../eventq.c ../checksum.c ../trace.c -Wall -lm) || exit 1
+(cd gbn && gcc -O2 -I.. -DGBN_CACHE=$CACHE -o ../$OUT/gbn_cache gbn.c emulator.c ../eventq.c ../checksum.c ../trace.c -Wall -lm) || exit 1
+
+# messages, loss, corruption, direction, mean time between messages
+scenarios=(
+    "2000 0.1 0.0 0 50.0"
+    "2000 0.1 0.1 2 50.0"
+    "2000 0.2 0.0 0 50.0"
+    "5000 0.05 0.0 0 20.0"
+    "5000 0.1 0.1 2 20.0"
+)
+
+# value after the last colon of the line of an output containing $2
+stat() {
+    echo "$1" | grep "$2" | sed 's/.*: *//; s/ .*//'
+}
+
+run() {
+    echo "$2 0" | $OUT/$1 -q calendar -S $SEED 2>/dev/null
+}
+
+printf "%-24s %-6s %10s %8s %8s %8s %s\n" "scenario" "gbn" "goodput" "deliv" "resends" "cached" "cache memory"
+for sc in "${scenarios[@]}"; do
+    for bin in gbn gbn_cache; do
+        out=$(run $bin "$sc")
+        t=$(echo "$out" | sed -n 's/.*Simulator terminated at time \([0-9.]*\).*/\1/p')
+        delivered=$(stat "$out" "delivered to application")
+        resent=$(stat "$out" "packet resends by A")
+        if [ $bin = gbn ]; then
+            label=classic; cached=-; memory=-
+        else
+            label="cache"; cached=$(stat "$out" "packets cached at B")
+            memory=$(echo "$out" | sed -n 's/out-of-order cache at B: //p')
+        fi
+        goodput=$(awk -v d="$delivered" -v t="$t" 'BEGIN { printf "%.5f", (t > 0 ? d / t : 0) }')
+        printf "%-24s %-6s %10s %8s %8s %8s %s\n" "$sc" "$label" "$goodput" "$delivered" "$resent" "$cached" "$memory"
+    done
+done
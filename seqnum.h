@@ -0,0 +1,33 @@
+/* ******************************************************************
+   Sequence number arithmetic shared by the protocols.
+
+   By default sequence numbers run from 0 to SEQSPACE-1, SEQSPACE being
+   defined by the protocol, and wrap with a modulus.  Built with -DSEQ32
+   they use all 32 bits of seqnum and wrap at 2^32, and are compared with
+   RFC 1982 serial number arithmetic: seq is within the n numbers from
+   base if the unsigned distance seq - base is below n, so a window check
+   is one subtraction and one compare, and windows are not limited by a
+   small sequence space.
+**********************************************************************/
+
+#ifdef SEQ32
+#define SEQ_NEXT(seq)    ((int)((unsigned int)(seq) + 1u))
+#define SEQ_PREV(seq)    ((int)((unsigned int)(seq) - 1u))
+#define SEQ_DIST(a, b)   ((unsigned int)(a) - (unsigned int)(b))   /* from b forward to a */
+#else
+#define SEQ_NEXT(seq)    (((seq) + 1) % SEQSPACE)
+#define SEQ_PREV(seq)    (((seq) - 1 + SEQSPACE) % SEQSPACE)
+#define SEQ_DIST(a, b)   ((unsigned int)(((a) - (b) + SEQSPACE) % SEQSPACE))
+#endif
+
+/* seq is one of the n numbers starting at base */
+#define SEQ_IN_WINDOW(seq, base, n)  (SEQ_DIST(seq, base) < (unsigned int)(n))
+
+/* smallest power of two >= n, for buffers indexed by seq modulo their
+   size: only a power of two keeps the slots of consecutive numbers
+   distinct when seq wraps at 2^32 */
+#define SEQ_OR1_(v)  ((v) | (v) >> 1)
+#define SEQ_OR2_(v)  (SEQ_OR1_(v) | SEQ_OR1_(v) >> 2)
+#define SEQ_OR4_(v)  (SEQ_OR2_(v) | SEQ_OR2_(v) >> 4)
+#define SEQ_OR8_(v)  (SEQ_OR4_(v) | SEQ_OR4_(v) >> 8)
+#define SEQ_POW2(n)  ((SEQ_OR8_((n) - 1) | SEQ_OR8_((n) - 1) >> 16) + 1)
@@ -1,8 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include "emulator.h"
+#include "checksum.h"
+#include "trace.h"
 #include "sr.h"
+#include "seqnum.h"
 
 /* ******************************************************************
    Selective Repeat protocol.  Adapted from J.F.Kurose
@@ -21,10 +25,53 @@
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#ifndef WINDOWSIZE
 #define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 12     /* the min sequence space for SR must be at least 2*WINDOWSIZE */
+#endif
+#define SEQSPACE (2 * WINDOWSIZE)   /* the min sequence space for SR must be at least 2*WINDOWSIZE */
+#ifdef SEQ32
+#define WINDOW_SLOTS SEQ_POW2(WINDOWSIZE)   /* buffer slots, see seqnum.h */
+#else
+#define WINDOW_SLOTS WINDOWSIZE
+#endif
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 #define MAX_RETRANSMIT 30  /* Maximum retransmissions per packet before giving up */
+#ifndef SR_NAK
+#define SR_NAK 0        /* 1: B sends NAKs for the packets missing before one it buffers */
+#endif
+#define NAK (-2)        /* seqnum of a NAK from B; its acknum is the packet asked for */
+#define NAK_HOLDOFF 2   /* packets buffered after a missing one before it is NAKed again */
+#ifndef SR_FEC
+#define SR_FEC 0        /* k: A sends a parity packet after every k new packets, 0 for none */
+#endif
+#if SR_FEC < 0 || SR_FEC > WINDOWSIZE
+#error "SR_FEC must be from 0 to WINDOWSIZE"
+#endif
+#define PARITY (-3)     /* acknum of a parity packet; its seqnum is the first of its group */
+#define FEC_SLOTS (2 * WINDOW_SLOTS)   /* payloads B keeps: its window and the one before */
+#ifndef SR_PACE
+#define SR_PACE 0       /* 1: A releases new packets at a paced rate instead of at once */
+#endif
+#ifndef PACE_INTERVAL
+#define PACE_INTERVAL 5.5   /* time units per paced packet: what the emulated channel takes */
+#endif                      /* per packet on average, 1 + 9 * uniform; RTT / WINDOWSIZE is 2.7 */
+#ifndef PACE_BURST
+#define PACE_BURST 1.0  /* packets that may leave back to back after a quiet spell */
+#endif
+#ifndef SR_PARTIAL
+#define SR_PARTIAL 0    /* 1: A abandons packets over their budget and B skips them */
+#endif
+#ifndef PR_RETRIES
+#define PR_RETRIES MAX_RETRANSMIT   /* resends of a packet before it is abandoned */
+#endif
+#ifndef PR_LIFETIME
+#define PR_LIFETIME 0.0 /* time units from first sending to abandoning, 0 for no limit */
+#endif
+#if SR_PARTIAL && SR_FEC
+#error "SR_PARTIAL cannot be combined with SR_FEC: B cannot rebuild a packet from a skipped one"
+#endif
+#define SKIP (-4)       /* acknum of a skip from A, seqnum where B's receive base moves to; */
+                        /* B answers with seqnum SKIP and the same number in acknum */
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
@@ -32,46 +79,39 @@
    the packet is corrupted.
 */
 
-/* Array to track retransmission counts for each packet in the window */ 
-static int retransmission_count[WINDOWSIZE] = {0};
-static int last_ack_sent = -1;  /* Last ACK number that was sent by receiver */
-static int timer_seq = 0;       /* Track which packet the timer is set for */
-static bool timer_running = false;
-
-int ComputeChecksum(struct pkt packet)
+int ComputeChecksum(const struct pkt *packet)
 {
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for (i = 0; i < 20; i++) 
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
+  /* kernel (byte sum, Internet checksum or CRC32C) is chosen with -c */
+  return pkt_checksum(packet);
 }
 
-bool IsCorrupted(struct pkt packet)
+bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
 }
 
-/* Helper functions for timer management */ 
-static void safe_start_timer(int entity, float increment) {
-    if (!timer_running) {
-        starttimer(entity, increment);
-        timer_running = true;
-    }
-}
-
-static void safe_stop_timer(int entity) {
-    if (timer_running) {
-        stoptimer(entity);
-        timer_running = false;
-    }
+/* counters of both entities, for protocol_print_stats(); each is only
+   updated by one of A and B */
+static struct {
+  int packets_sent[2];   /* by A and by B, parity, NAKs and skips included */
+  int msgs_accepted;     /* messages A took, not dropped with a full window */
+  int naks_sent;         /* SR_NAK: by B, for packets missing before one it buffers */
+  int nak_resends;       /* packets A sent again on a NAK, also in packets_resent */
+  int fec_sent;          /* SR_FEC: parity packets sent by A, one per SR_FEC new packets */
+  int fec_rebuilt;       /* packets B rebuilt from a parity packet */
+  int msgs_abandoned;    /* SR_PARTIAL: messages A gave up on, delivered or not */
+  int skips_sent;        /* skips A sent to move B past them, resends included */
+  int msgs_skipped;      /* messages B never delivered */
+} stats;
+
+/* A and B send every packet through here */
+static void send_packet(int AorB, struct pkt *packet)
+{
+  stats.packets_sent[AorB]++;
+  tolayer3_ref(AorB, packet);
 }
 
 /********* Sender (A) variables and functions ************/
@@ -80,288 +120,726 @@ static void safe_stop_timer(int entity) {
 typedef enum {
     UNUSED,        /* empty slot in send window */
     SENT,          /* packet sent, waiting for ACK */
-    ACKED          /* packet acknowledged */
+    ACKED,         /* packet acknowledged */
+    ABANDONED      /* packet given up on, with SR_PARTIAL */
 } packet_status;
 
-static struct pkt send_buffer[WINDOWSIZE];      /* array for storing packets */
-static packet_status send_status[WINDOWSIZE];  /* status of each packet */
-static int send_base;                         /* sequence number of first unACKed packet */
-static int next_seqnum;                      /* next sequence number to use */
+/* sender state of one flow */
+struct sender {
+  struct pkt *send_buffer[WINDOW_SLOTS];     /* handles of packets in the window */
+  packet_status send_status[WINDOW_SLOTS];  /* status of each packet */
+  int retransmission_count[WINDOW_SLOTS];  /* retransmissions of each packet in the window */
+  int send_base;                        /* sequence number of first unACKed packet */
+  int next_seqnum;                     /* next sequence number to use */
+  int timer_seq;                      /* Track which packet the timer is set for */
+  bool timer_running;
+#if SR_FEC
+  int fec_first;                      /* first sequence number of the open parity group */
+  int fec_count;                      /* packets in the group so far */
+  char fec_parity[20];                /* XOR of their payloads */
+#endif
+#if SR_PACE
+  struct msg pace_queue[WINDOWSIZE];  /* messages taken but not sent yet, a ring */
+  int pace_head, pace_len;
+  double tokens;                      /* packets that may be sent now, up to PACE_BURST */
+  double tokens_at;                   /* time tokens was brought up to date */
+  double rto_at;                      /* when the retransmission timer goes off, if timer_running */
+  double pace_at;                     /* when the next queued message may go, if pace_len > 0 */
+  double timer_at;                    /* what A's timer is set for, -1 if it is not running */
+#endif
+#if SR_PARTIAL
+  double sent_at[WINDOW_SLOTS];       /* when each packet in the window was first sent */
+  int skip_to;                        /* where B is told to move its receive base */
+  int skip_from;                      /* lowest receive base B can have while a skip is pending */
+  bool skip_pending;                  /* B has not answered the skip yet */
+#endif
+};
+
+static struct sender *senders = NULL;   /* one per flow, indexed by current_flow */
+
+#if SR_PACE
+/* A has one timer, and paced senders need two: one to retransmit and one
+   to release the next queued message.  Both are kept as deadlines, and
+   the timer is set for the earlier of them. */
+static void set_timer(struct sender *s)
+{
+  double at = -1.0;
+
+  if (s->timer_running)
+    at = s->rto_at;
+  if (s->pace_len > 0 && (at < 0.0 || s->pace_at < at))
+    at = s->pace_at;
+  if (at == s->timer_at)
+    return;
+  if (s->timer_at >= 0.0)
+    stoptimer(A);
+  if (at >= 0.0)
+    starttimer(A, at > get_sim_time() ? at - get_sim_time() : 0.0);
+  s->timer_at = at;
+}
+#endif
+
+/* Helper functions for timer management */ 
+static void safe_start_timer(struct sender *s, int entity, float increment) {
+    if (!s->timer_running) {
+#if SR_PACE
+        s->rto_at = get_sim_time() + increment;
+        s->timer_running = true;
+        set_timer(s);
+#else
+        starttimer(entity, increment);
+        s->timer_running = true;
+#endif
+    }
+}
+
+static void safe_stop_timer(struct sender *s, int entity) {
+    if (s->timer_running) {
+#if SR_PACE
+        s->timer_running = false;
+        set_timer(s);
+#else
+        stoptimer(entity);
+        s->timer_running = false;
+#endif
+    }
+}
 
 /* Helper function to translate sequence number to buffer index */
 static int seq_to_index(int seqnum)
 {
-    return seqnum % WINDOWSIZE;
+    return (unsigned int)seqnum % WINDOW_SLOTS;
 }
 
 /* Helper function to check if seqnum is in send window */
-static bool in_send_window(int seqnum)
+static bool in_send_window(struct sender *s, int seqnum)
 {
-    int window_end;
+    /* distance from the base, wrap included */
+    return SEQ_IN_WINDOW(seqnum, s->send_base, WINDOWSIZE);
+}
 
-    window_end = (send_base + WINDOWSIZE - 1) % SEQSPACE;
-    
-    if (send_base <= window_end) {
-        /* Normal case: window doesn't wrap around */
-        return (seqnum >= send_base && seqnum <= window_end);
-    } else {
-        /* window wraps around */
-        return (seqnum >= send_base || seqnum <= window_end);
+/* Check the sender window: at most WINDOWSIZE packets outstanding and every
+   slot inside the window in use.  A failure dumps the trace ring */
+static void check_send_window(struct sender *s)
+{
+  int seq;
+
+  if (SEQ_DIST(s->next_seqnum, s->send_base) > WINDOWSIZE) {
+    fprintf(stderr, "INVARIANT FAILED: send window %d..%d larger than %d\n", s->send_base, s->next_seqnum, WINDOWSIZE);
+    trace_ring_dump("send window overflow");
+    return;
+  }
+  for (seq = s->send_base; seq != s->next_seqnum; seq = SEQ_NEXT(seq)) {
+    if (s->send_status[seq_to_index(seq)] == UNUSED) {
+      fprintf(stderr, "INVARIANT FAILED: packet %d inside send window has no state\n", seq);
+      trace_ring_dump("unused slot in send window");
+      return;
     }
+  }
+}
+
+/* whether A gives up on the packet in slot index instead of sending it
+   again: after MAX_RETRANSMIT resends, or with SR_PARTIAL once it is over
+   its retry budget or its lifetime */
+static bool over_budget(struct sender *s, int index)
+{
+#if SR_PARTIAL
+  if (PR_LIFETIME > 0.0 && get_sim_time() - s->sent_at[index] >= PR_LIFETIME)
+    return true;
+  return s->retransmission_count[index] >= PR_RETRIES;
+#else
+  return s->retransmission_count[index] >= MAX_RETRANSMIT;
+#endif
+}
+
+/* give up on packet seq.  Without SR_PARTIAL it is taken as delivered,
+   which B may never have had; with it, the message is counted as
+   abandoned and B is told to skip it once the window slides past it */
+static void abandon(struct sender *s, int seq)
+{
+  TRACE_EVENT(TR_GIVEUP, A, seq, -1, 0);
+#if SR_PARTIAL
+  s->send_status[seq_to_index(seq)] = ABANDONED;
+  stats.msgs_abandoned++;
+#else
+  trace_ring_dump("max retransmit give up");
+  s->send_status[seq_to_index(seq)] = ACKED;
+#endif
+}
+
+#if SR_PARTIAL
+/* send the skip to skip_to, again if resend is set.  Until B answers, its
+   receive base may be as low as skip_from; the timer keeps running to
+   send the skip again even with nothing else to time */
+static void send_skip(struct sender *s, bool resend)
+{
+  struct pkt *skippkt;
+  int i;
+
+  if (TRACE > 0)
+    printf("----A: tell B to skip to %d\n", s->skip_to);
+  TRACE_EVENT(TR_SKIP_SEND, A, s->skip_to, SKIP, resend ? TRF_DUP : 0);
+  skippkt = pkt_alloc();
+  skippkt->seqnum = s->skip_to;
+  skippkt->acknum = SKIP;
+  for (i = 0; i < 20 ; i++)
+    skippkt->payload[i] = '0';
+  skippkt->checksum = ComputeChecksum(skippkt);
+  send_packet(A, skippkt);
+  pkt_release(skippkt);
+  stats.skips_sent++;
+  if (!s->timer_running) {
+    s->timer_seq = s->send_base;
+    safe_start_timer(s, A, RTT);
+  }
+}
+
+/* the window has slid from old_base past abandoned packets: B is to move
+   its receive base to the new send base.  With no skip pending, B had
+   every packet before old_base, so its receive base is at least that */
+static void skip_abandoned(struct sender *s, int old_base)
+{
+  if (!s->skip_pending) {
+    s->skip_from = old_base;
+    s->skip_pending = true;
+  }
+  s->skip_to = s->send_base;
+  send_skip(s, false);
+}
+
+/* B answers a skip with the number it was told: an answer to an earlier
+   skip says nothing about the one pending */
+static void skip_answered(struct sender *s, int seq)
+{
+  if (!s->skip_pending || seq != s->skip_to)
+    return;
+  if (TRACE > 0)
+    printf("----A: B has skipped to %d\n", seq);
+  s->skip_pending = false;
+  if (s->send_base == s->next_seqnum)
+    safe_stop_timer(s, A);
 }
+#endif
 
-/* Called to mark a packet as delivered if it's been retransmitted too many times */
-static void advance_window_if_needed()
+/* whether A may send n more new packets than it has.  While a skip is
+   pending B's window may start as far back as skip_from: B would drop a
+   packet WINDOWSIZE or more past it, and take a skip beyond that for an
+   old one */
+static bool skip_allows(struct sender *s, int n)
 {
+#if SR_PARTIAL
+  return !s->skip_pending || SEQ_DIST(s->next_seqnum, s->skip_from) + n < WINDOWSIZE;
+#else
+  return true;
+#endif
+}
+
+/* slide the window over the packets at its base that are done with,
+   ACKed or abandoned */
+static void slide_window(struct sender *s)
+{
+  int old_base = s->send_base;
+#if SR_PARTIAL
+  bool skipped = false;
+#endif
+
+  while (s->send_base != s->next_seqnum &&
+          s->send_status[seq_to_index(s->send_base)] != SENT) {
+#if SR_PARTIAL
+    if (s->send_status[seq_to_index(s->send_base)] == ABANDONED)
+      skipped = true;
+#endif
+    /* Mark slot as unused */
+    s->send_status[seq_to_index(s->send_base)] = UNUSED;
+    /* Slide window by one */
+    s->send_base = SEQ_NEXT(s->send_base);
+  }
+  if (s->send_base != old_base)
+    TRACE_EVENT(TR_WINDOW_SLIDE, A, s->send_base, -1, 0);
+#if SR_PARTIAL
+  if (skipped)
+    skip_abandoned(s, old_base);
+#endif
+}
+
+/* Called to give up on the packets at the base that are over their budget */
+static void advance_window_if_needed(struct sender *s)
+{
+#if SR_PARTIAL
+  int seq;
+
+  /* abandon them, then slide the window past them and what is ACKED */
+  /* between them, so that B is told to skip them all at once         */
+  for (seq = s->send_base; seq != s->next_seqnum; seq = SEQ_NEXT(seq)) {
+    int index = seq_to_index(seq);
+    if (s->send_status[index] == SENT) {
+      if (!over_budget(s, index))
+        break;
+      if (TRACE > 0)
+        printf("----A: Packet %d is over its budget, abandoning it\n", seq);
+      abandon(s, seq);
+    }
+  }
+  slide_window(s);
+#else
+  int old_base = s->send_base;
+
   /* If the base packet has been retransmitted too many times, mark it as delivered and advance window */
-  while (send_base != next_seqnum) {
-    int index = seq_to_index(send_base);
-    if (send_status[index] == SENT && retransmission_count[index] >= MAX_RETRANSMIT) {
+  while (s->send_base != s->next_seqnum) {
+    int index = seq_to_index(s->send_base);
+    if (s->send_status[index] == SENT && over_budget(s, index)) {
       if (TRACE > 0) {
-        printf("----A: Packet %d exceeded max retransmissions, marking as delivered\n", send_base);
+        printf("----A: Packet %d exceeded max retransmissions, marking as delivered\n", s->send_base);
       }
-      send_status[index] = ACKED;
+      abandon(s, s->send_base);
       /* Continue the check by looking at next base */
-      send_base = (send_base + 1) % SEQSPACE;
+      s->send_base = SEQ_NEXT(s->send_base);
     } else {
       break;
     }
   }
+  if (s->send_base != old_base)
+    TRACE_EVENT(TR_WINDOW_SLIDE, A, s->send_base, -1, 0);
+#endif
 }
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+#if SR_FEC
+/* add a new packet to the open parity group, and send the group's parity
+   packet once it has SR_FEC packets.  The parity packet is sent once and
+   never acknowledged; a group left open at the end has no parity. */
+static void fec_add(struct sender *s, const struct pkt *packet)
+{
+  struct pkt *paritypkt;
+  int i;
+
+  if (s->fec_count == 0) {
+    s->fec_first = packet->seqnum;
+    memset(s->fec_parity, 0, sizeof(s->fec_parity));
+  }
+  for (i = 0; i < 20; i++)
+    s->fec_parity[i] ^= packet->payload[i];
+  if (++s->fec_count < SR_FEC)
+    return;
+
+  paritypkt = pkt_alloc();
+  paritypkt->seqnum = s->fec_first;
+  paritypkt->acknum = PARITY;
+  memcpy(paritypkt->payload, s->fec_parity, sizeof(paritypkt->payload));
+  paritypkt->checksum = ComputeChecksum(paritypkt);
+  if (TRACE > 0)
+    printf("Sending parity of packets %d to %d to layer 3\n", s->fec_first, packet->seqnum);
+  TRACE_EVENT(TR_SEND, A, s->fec_first, PARITY, 0);
+  send_packet(A, paritypkt);
+  pkt_release(paritypkt);
+  stats.fec_sent++;
+  s->fec_count = 0;
+}
+#endif
+
+/* send a message as the packet next_seqnum; the window has room for it */
+static void send_new(struct sender *s, const struct msg *message)
 {
-  struct pkt sendpkt;
+  struct pkt *sendpkt;
   int i;
   int index;
 
-  /* Check if we need to advance the window due to too many retransmissions */
-  advance_window_if_needed();
+  /* create packet */
+  sendpkt = pkt_alloc();
+  sendpkt->seqnum = s->next_seqnum;
+  sendpkt->acknum = NOTINUSE;
+  for (i = 0; i < 20 ; i++) 
+    sendpkt->payload[i] = message->data[i];
+  sendpkt->checksum = ComputeChecksum(sendpkt); 
+
+  /* store packet in send buffer, dropping the packet this slot held before */
+  index = seq_to_index(s->next_seqnum);
+  if (s->send_buffer[index] != NULL)
+    pkt_release(s->send_buffer[index]);
+  s->send_buffer[index] = sendpkt;
+  s->send_status[index] = SENT;
+  s->retransmission_count[index] = 0;  /* Reset retransmission counter for new packet */
+#if SR_PARTIAL
+  s->sent_at[index] = get_sim_time();
+#endif
 
-  /* check if we can send a new packet */
-  if (in_send_window(next_seqnum)) {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+  /* send out packet */
+  if (TRACE > 0)
+    printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+  TRACE_EVENT(TR_SEND, A, sendpkt->seqnum, NOTINUSE, 0);
+  send_packet(A, sendpkt);
+#if SR_FEC
+  fec_add(s, sendpkt);
+#endif
+  
+  /* Start timer if this is the first packet in the window */
+  if (s->send_base == s->next_seqnum) {
+    safe_start_timer(s, A, RTT);
+    /* Record the serial number corresponding to the timer */
+    s->timer_seq = s->send_base;
+  }
 
-    /* create packet */
-    sendpkt.seqnum = next_seqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i = 0; i < 20 ; i++) 
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt); 
+  /* get next sequence number, wrap back to 0 */
+  s->next_seqnum = SEQ_NEXT(s->next_seqnum);  
+}
 
-    /* store packet in send buffer */
-    index = seq_to_index(next_seqnum);
-    send_buffer[index] = sendpkt;
-    send_status[index] = SENT;
-    retransmission_count[index] = 0;  /* Reset retransmission counter for new packet */
+#if SR_PACE
+/* token bucket: a token accrues every PACE_INTERVAL, up to PACE_BURST, and
+   each queued message takes one to leave.  Called as messages are queued
+   and when the release deadline comes; force is set then, so that rounding
+   of the time cannot leave the bucket just short of a token. */
+static void pace_release(struct sender *s, bool force)
+{
+  double now = get_sim_time();
+
+  s->tokens += (now - s->tokens_at) / PACE_INTERVAL;
+  if (s->tokens > PACE_BURST)
+    s->tokens = PACE_BURST;
+  if (force && s->tokens < 1.0)
+    s->tokens = 1.0;
+  s->tokens_at = now;
+  while (s->pace_len > 0 && s->tokens >= 1.0) {
+    s->tokens -= 1.0;
+    send_new(s, &s->pace_queue[s->pace_head]);
+    s->pace_head = (s->pace_head + 1) % WINDOWSIZE;
+    s->pace_len--;
+  }
+  if (s->pace_len > 0)
+    s->pace_at = now + (1.0 - s->tokens) * PACE_INTERVAL;
+  set_timer(s);
+}
+#endif
 
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
-    
-    /* Start timer if this is the first packet in the window */
-    if (send_base == next_seqnum) {
-      safe_start_timer(A, RTT);
-      /* Record the serial number corresponding to the timer */
-      timer_seq = send_base;
-    }
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+void A_output(struct msg message)
+{
+  struct sender *s = &senders[current_flow];
+
+  /* Check if we need to advance the window due to too many retransmissions */
+  advance_window_if_needed(s);
 
-    /* get next sequence number, wrap back to 0 */
-    next_seqnum = (next_seqnum + 1) % SEQSPACE;  
+  /* check if we can send a new packet; paced, the messages queued */
+  /* already have their places in the window                      */
+#if SR_PACE
+  if (SEQ_DIST(s->next_seqnum, s->send_base) + s->pace_len < WINDOWSIZE &&
+      skip_allows(s, s->pace_len)) {
+    if (TRACE > 1)
+      printf("----A: New message arrives, send window is not full, queue it for pacing\n");
+    s->pace_queue[(s->pace_head + s->pace_len) % WINDOWSIZE] = message;
+    s->pace_len++;
+    stats.msgs_accepted++;
+    pace_release(s, false);
+  }
+#else
+  if (in_send_window(s, s->next_seqnum) && skip_allows(s, 0)) {
+    if (TRACE > 1)
+      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+    send_new(s, &message);
+    stats.msgs_accepted++;
   }
+#endif
   /* if blocked,  window is full */
   else {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
+    TRACE_EVENT(TR_WINDOW_FULL, A, -1, -1, 0);
     window_full++;
   }
+  check_send_window(s);
 }
 
 
+#if SR_NAK
+/* B is missing seqnum: send it again now rather than on a timeout.  The
+   timer is left alone, it still runs for the packet it was started for. */
+static void resend_on_nak(struct sender *s, int seqnum)
+{
+  int index = seq_to_index(seqnum);
+
+  if (!in_send_window(s, seqnum) || s->send_status[index] != SENT ||
+      over_budget(s, index)) {
+    if (TRACE > 0)
+      printf("----A: NAK %d is received, packet not resent\n", seqnum);
+    TRACE_EVENT(TR_NAK, A, seqnum, -1, TRF_DUP);
+    return;
+  }
+  if (TRACE > 0)
+    printf("----A: NAK %d is received, resending packet\n", seqnum);
+  TRACE_EVENT(TR_NAK, A, seqnum, -1, 0);
+  send_packet(A, s->send_buffer[index]);
+  packets_resent++;
+  stats.nak_resends++;
+  s->retransmission_count[index]++;
+}
+#endif
+
 /* called from layer 3, when a packet arrives for layer 4 
-   In this practical this will always be an ACK as B never sends data.
+   In this practical this will always be an ACK (or, with SR_NAK, a NAK)
+   as B never sends data.
 */
-void A_input(struct pkt packet)
+void A_input_ref(struct pkt *packet)
 {
+  struct sender *s = &senders[current_flow];
   int index;
   bool need_restart_timer = false;
 
   /* if received ACK is not corrupted */ 
   if (!IsCorrupted(packet)) {
+#if SR_NAK
+    if (packet->seqnum == NAK) {
+      resend_on_nak(s, packet->acknum);
+      check_send_window(s);
+      return;
+    }
+#endif
+#if SR_PARTIAL
+    if (packet->seqnum == SKIP) {
+      skip_answered(s, packet->acknum);
+      return;
+    }
+#endif
     if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
+      printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
     
      /* First check if this is an ACK for the packet right before our window */
-    if (packet.acknum == ((send_base - 1 + SEQSPACE) % SEQSPACE)) {
+    if (packet->acknum == SEQ_PREV(s->send_base)) {
       if (TRACE > 0)
-        printf("----A: ACK %d is a duplicate (for packet before window)\n", packet.acknum);
+        printf("----A: ACK %d is a duplicate (for packet before window)\n", packet->acknum);
+      TRACE_EVENT(TR_ACK, A, -1, packet->acknum, TRF_DUP);
       return;
     }
 
      /* Check if the ACK is for a packet in our send window */
-    if (in_send_window(packet.acknum)) {
-      index = seq_to_index(packet.acknum);
+    if (in_send_window(s, packet->acknum)) {
+      index = seq_to_index(packet->acknum);
     
       /* Check if this packet hasn't been ACKed yet */
-      if (send_status[index] == SENT) {
+      if (s->send_status[index] == SENT) {
         /* Mark packet as acknowledged */
-        send_status[index] = ACKED;
-        retransmission_count[index] = 0;  /* Reset retransmission counter */
+        s->send_status[index] = ACKED;
+        record_resends(s->retransmission_count[index]);
+        s->retransmission_count[index] = 0;  /* Reset retransmission counter */
         
         if (TRACE > 0)
-          printf("----A: ACK %d is not a duplicate\n",packet.acknum);
+          printf("----A: ACK %d is not a duplicate\n",packet->acknum);
+        TRACE_EVENT(TR_ACK, A, -1, packet->acknum, 0);
         new_ACKs++;
 
         /* Always stop the timer when receiving a valid ACK */
-        safe_stop_timer(A);
+        safe_stop_timer(s, A);
         need_restart_timer = true;
       } else {
         /* ACK for already acknowledged packet */
         if (TRACE > 0)
-          printf("----A: ACK %d is a duplicate\n", packet.acknum);
+          printf("----A: ACK %d is a duplicate\n", packet->acknum);
+        TRACE_EVENT(TR_ACK, A, -1, packet->acknum, TRF_DUP);
       }
 
       /* Slide window over all consecutively ACKed packets */
-      while (send_base != next_seqnum && 
-              send_status[seq_to_index(send_base)] == ACKED) {
-        /* Mark slot as unused */
-        send_status[seq_to_index(send_base)] = UNUSED;
-        /* Slide window by one */
-        send_base = (send_base + 1) % SEQSPACE;
-      }
+      slide_window(s);
 
       /* Check again if we need to advance window due to max retransmissions */
-      advance_window_if_needed();
+      advance_window_if_needed(s);
 
       /* If we need to restart the timer and there are unacked packets */
-      if (need_restart_timer && send_base != next_seqnum) {
+      if (need_restart_timer && s->send_base != s->next_seqnum) {
         /* Find the first unacked packet */
-        int first_unacked = send_base;
-        while (first_unacked != next_seqnum) {
-            if (send_status[seq_to_index(first_unacked)] == SENT) {
+        int first_unacked = s->send_base;
+        while (first_unacked != s->next_seqnum) {
+            if (s->send_status[seq_to_index(first_unacked)] == SENT) {
                 break;
             }
-            first_unacked = (first_unacked + 1) % SEQSPACE;
+            first_unacked = SEQ_NEXT(first_unacked);
         }
         
-        if (first_unacked != next_seqnum) {
+        if (first_unacked != s->next_seqnum) {
             /* Set timer for the first unacked packet */
-            timer_seq = first_unacked;
-            safe_start_timer(A, RTT);
+            s->timer_seq = first_unacked;
+            safe_start_timer(s, A, RTT);
         }
       }
+#if SR_PARTIAL
+      /* the timer still sends the skip again */
+      if (s->skip_pending && !s->timer_running) {
+        s->timer_seq = s->send_base;
+        safe_start_timer(s, A, RTT);
+      }
+#endif
     }
     else {
       if (TRACE > 0)
-        printf("----A: ACK %d outside window, do nothing!\n", packet.acknum);
+        printf("----A: ACK %d outside window, do nothing!\n", packet->acknum);
+      TRACE_EVENT(TR_ACK, A, -1, packet->acknum, TRF_DUP);
     }
   }
   else {
     if (TRACE > 0)
       printf ("----A: corrupted ACK is received, do nothing!\n");
+    TRACE_EVENT(TR_ACK_CORRUPT, A, -1, -1, 0);
   }
+  check_send_window(s);
+}
+
+/* by-value entry point kept for compatibility: the packet is copied into */
+/* a pool buffer since A_input_ref() may keep a reference to it */
+void A_input(struct pkt packet)
+{
+  struct pkt *p;
+
+  p = pkt_alloc();
+  *p = packet;
+  A_input_ref(p);
+  pkt_release(p);
 }
 
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
+  struct sender *s = &senders[current_flow];
   int index;
+#if SR_PACE
+  double fired = s->timer_at;
+  bool pace_due;
+
+  /* the timer went off for the earlier deadline, maybe for both */
+  s->timer_at = -1.0;
+  pace_due = s->pace_len > 0 && s->pace_at <= fired;
+  if (!s->timer_running || s->rto_at > fired) {
+    if (pace_due)
+      pace_release(s, true);
+    else
+      set_timer(s);
+    return;
+  }
+#endif
   
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
+  TRACE_EVENT(TR_TIMEOUT, A, s->timer_seq, -1, 0);
 
-  timer_running = false; /* Reset timer state */ 
+  s->timer_running = false; /* Reset timer state */ 
+#if SR_PARTIAL
+  if (s->skip_pending)
+    send_skip(s, true);
+#endif
   
   /* Only process if there are unacked packets */
-  if (send_base != next_seqnum) {
-    index = seq_to_index(timer_seq);
+  if (s->send_base != s->next_seqnum) {
+    index = seq_to_index(s->timer_seq);
 
-    if (send_status[index] == SENT) {
+    if (s->send_status[index] == SENT) {
       /* Only retransmit if we haven't reached max retransmissions */
-      if (retransmission_count[index] < MAX_RETRANSMIT) {
+      if (!over_budget(s, index)) {
         if (TRACE > 0)
-          printf("---A: resending packet %d\n", timer_seq);
+          printf("---A: resending packet %d\n", s->timer_seq);
+        TRACE_EVENT(TR_RESEND, A, s->timer_seq, -1, 0);
         
-        tolayer3(A, send_buffer[index]); 
+        send_packet(A, s->send_buffer[index]); 
         packets_resent++;
-        retransmission_count[index]++;
+        s->retransmission_count[index]++;
 
         /* Restart timer for this packet */
-        safe_start_timer(A, RTT);
+        safe_start_timer(s, A, RTT);
       } else {
         if (TRACE > 0)
-          printf("---A: packet %d has reached max retransmissions (%d)\n", timer_seq, retransmission_count[index]);
-
-        /* Mark as ACKed to allow window to advance */
-        send_status[index] = ACKED;
+          printf("---A: packet %d has reached max retransmissions (%d)\n", s->timer_seq, s->retransmission_count[index]);
+        /* Give it up to allow window to advance */
+        abandon(s, s->timer_seq);
 
         /* Slide window over all consecutively ACKed packets */
-        while (send_base != next_seqnum && 
-              send_status[seq_to_index(send_base)] == ACKED) {
-          /* Mark slot as unused */
-          send_status[seq_to_index(send_base)] = UNUSED;
-          /* Slide window by one */
-          send_base = (send_base + 1) % SEQSPACE;
-        }
+        slide_window(s);
 
         /* Check if more packets need max retransmission handling */
-        advance_window_if_needed();
+        advance_window_if_needed(s);
 
         /* Start timer for next unacked packet if any */
-        if (send_base != next_seqnum) {
+        if (s->send_base != s->next_seqnum) {
           /* Find the first unacked packet */
-          int first_unacked = send_base;
-          while (first_unacked != next_seqnum) {
-            if (send_status[seq_to_index(first_unacked)] == SENT) {
+          int first_unacked = s->send_base;
+          while (first_unacked != s->next_seqnum) {
+            if (s->send_status[seq_to_index(first_unacked)] == SENT) {
               break;
             }
-            first_unacked = (first_unacked + 1) % SEQSPACE;
+            first_unacked = SEQ_NEXT(first_unacked);
           }
           
-          if (first_unacked != next_seqnum) {
-            timer_seq = first_unacked;
-            safe_start_timer(A, RTT);
+          if (first_unacked != s->next_seqnum) {
+            s->timer_seq = first_unacked;
+            safe_start_timer(s, A, RTT);
           }
         }
       }
     } else {
       /* Find next unacked packet to time */
-      int first_unacked = send_base;
-      while (first_unacked != next_seqnum) {
-        if (send_status[seq_to_index(first_unacked)] == SENT) {
+      int first_unacked = s->send_base;
+      while (first_unacked != s->next_seqnum) {
+        if (s->send_status[seq_to_index(first_unacked)] == SENT) {
           break;
         }
-        first_unacked = (first_unacked + 1) % SEQSPACE;
+        first_unacked = SEQ_NEXT(first_unacked);
       }
         
-      if (first_unacked != next_seqnum) {
-        timer_seq = first_unacked;
-        safe_start_timer(A, RTT);
+      if (first_unacked != s->next_seqnum) {
+        s->timer_seq = first_unacked;
+        safe_start_timer(s, A, RTT);
       }
     }
   }
+#if SR_PACE
+  /* the retransmission is out first; then a release due at the same time */
+  if (pace_due)
+    pace_release(s, true);
+  else
+    set_timer(s);
+#endif
+  check_send_window(s);
 }
 
 
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
+/* the following routine will be called once (only) for each flow, with */
+/* current_flow set, before any other entity A routines are called. You  */
+/* can use it to do any initialization */
 void A_init(void)
 {
+  struct sender *s;
   int i;
+
+  if (senders == NULL) {
+    senders = malloc(nflows * sizeof(struct sender));
+    if (senders == NULL) {
+      printf("memory allocation for sender state failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  s = &senders[current_flow];
     
   /* Initialize sender state */
-  send_base = 0;
-  next_seqnum = 0;
-  timer_seq = 0;
-  timer_running = false;
+  s->send_base = 0;
+  s->next_seqnum = 0;
+  s->timer_seq = 0;
+  s->timer_running = false;
+#if SR_FEC
+  s->fec_count = 0;
+#endif
+#if SR_PACE
+  s->pace_head = 0;
+  s->pace_len = 0;
+  s->tokens = PACE_BURST;
+  s->tokens_at = get_sim_time();
+  s->rto_at = 0.0;
+  s->pace_at = 0.0;
+  s->timer_at = -1.0;
+#endif
+#if SR_PARTIAL
+  s->skip_to = 0;
+  s->skip_from = 0;
+  s->skip_pending = false;
+#endif
   
   /* Initialize send buffer and status */
-  for (i = 0; i < WINDOWSIZE; i++) {
-    send_status[i] = UNUSED;
-    retransmission_count[i] = 0;  /* Initialize retransmission counters */
+  for (i = 0; i < WINDOW_SLOTS; i++) {
+    s->send_buffer[i] = NULL;
+    s->send_status[i] = UNUSED;
+    s->retransmission_count[i] = 0;  /* Initialize retransmission counters */
   }
 }
 
@@ -369,149 +847,479 @@ void A_init(void)
 
 /********* Receiver (B)  variables and procedures ************/
 
-/* Selective Repeat data structures for receiver */
-static struct pkt recv_buffer[WINDOWSIZE];      /* buffer for out-of-order packets */
-static bool recv_status[WINDOWSIZE];           /* status for each packet in window */
-static int recv_base;                          /* lowest sequence number in window */
-static int B_nextseqnum;                       /* sequence number for ACK packets */
+/* Selective Repeat data structures for receiver, one set per flow */
+struct receiver {
+  struct pkt *recv_buffer[WINDOW_SLOTS];     /* held handles of out-of-order packets */
+  bool recv_status[WINDOW_SLOTS];           /* status for each packet in window */
+  int recv_base;                         /* lowest sequence number in window */
+  int B_nextseqnum;                     /* sequence number for ACK packets */
+  int last_ack_sent;                   /* Last ACK number that was sent by receiver */
+#if SR_NAK
+  int nak_wait[WINDOW_SLOTS];          /* packets to buffer before NAKing a missing one again */
+#endif
+#if SR_FEC
+  char fec_data[FEC_SLOTS][20];        /* payloads received, by seqnum modulo FEC_SLOTS */
+#endif
+};
+
+static struct receiver *receivers = NULL;   /* one per flow, indexed by current_flow */
 
 /* Helper function to check if seqnum is in receive window */
-static bool in_recv_window(int seqnum)
+static bool in_recv_window(struct receiver *r, int seqnum)
 {
-    int window_end;
-
     /* For the receiver, we also need to acknowledge packets right before the window */ 
-    if (seqnum == ((recv_base - 1 + SEQSPACE) % SEQSPACE))
+    if (seqnum == SEQ_PREV(r->recv_base))
         return false;
 
-    window_end = (recv_base + WINDOWSIZE - 1) % SEQSPACE;
-    
-    if (recv_base <= window_end) {
-        /* Normal case: window doesn't wrap around */
-        return (seqnum >= recv_base && seqnum <= window_end);
-    } else {
-        /* window wraps around */
-        return (seqnum >= recv_base || seqnum <= window_end);
-    }
+    return SEQ_IN_WINDOW(seqnum, r->recv_base, WINDOWSIZE);
 }
 
 /* Helper function to translate sequence number to buffer index */
 static int recv_seq_to_index(int seqnum)
 {
-    return seqnum % WINDOWSIZE;
+    return (unsigned int)seqnum % WINDOW_SLOTS;
+}
+
+#if SR_NAK
+/* NAK the packets missing between the receive base and seqnum, a packet
+   just buffered.  A missing packet is NAKed when the first packet after
+   it is buffered, then again every NAK_HOLDOFF packets buffered after it
+   while it is still missing, in case the NAK or the resent packet is lost. */
+static void send_naks(struct receiver *r, int seqnum)
+{
+  struct pkt *nakpkt;
+  int seq, index, i;
+
+  for (seq = r->recv_base; seq != seqnum; seq = SEQ_NEXT(seq)) {
+    index = recv_seq_to_index(seq);
+    if (r->recv_status[index])
+      continue;
+    if (r->nak_wait[index] > 0) {
+      r->nak_wait[index]--;
+      continue;
+    }
+    r->nak_wait[index] = NAK_HOLDOFF;
+
+    if (TRACE > 1)
+      printf("----B: packet %d is missing, send NAK!\n", seq);
+    TRACE_EVENT(TR_NAK_SEND, B, seq, -1, 0);
+    nakpkt = pkt_alloc();
+    nakpkt->seqnum = NAK;
+    nakpkt->acknum = seq;
+    for (i = 0; i < 20 ; i++)
+      nakpkt->payload[i] = '0';
+    nakpkt->checksum = ComputeChecksum(nakpkt);
+    send_packet(B, nakpkt);
+    pkt_release(nakpkt);
+    stats.naks_sent++;
+  }
+}
+#endif
+
+/* deliver the packets buffered from the receive base on, advancing it */
+static void deliver_in_order(struct receiver *r)
+{
+  int index;
+
+  while (r->recv_status[recv_seq_to_index(r->recv_base)]) {
+    /* Deliver packet to layer 5 */
+    index = recv_seq_to_index(r->recv_base);
+    tolayer5(B, r->recv_buffer[index]->payload);
+    
+    /* Mark buffer slot as empty */
+    pkt_release(r->recv_buffer[index]);
+    r->recv_status[index] = false;
+#if SR_NAK
+    r->nak_wait[index] = 0;
+#endif
+    
+    /* Advance receive window */
+    r->recv_base = SEQ_NEXT(r->recv_base);
+  }
 }
 
+#if SR_PARTIAL
+/* A has abandoned the packets before seq.  B delivers those of them it
+   holds, skips the others, and moves its receive base to seq, then on
+   over what it has buffered after.  A skip to at most WINDOWSIZE past the
+   receive base is new (A keeps its packets within that while a skip is
+   pending); one further on is an old one B is already past.  B answers
+   either way, so that A stops sending it. */
+static void skip_forward(struct receiver *r, int seq)
+{
+  struct pkt *reply;
+  int index, i;
+  bool old = SEQ_DIST(seq, r->recv_base) > WINDOWSIZE;
+
+  while (!old && r->recv_base != seq) {
+    index = recv_seq_to_index(r->recv_base);
+    if (r->recv_status[index]) {
+      tolayer5(B, r->recv_buffer[index]->payload);
+      pkt_release(r->recv_buffer[index]);
+      r->recv_status[index] = false;
+    }
+    else {
+      tolayer5_skip(B);
+      stats.msgs_skipped++;
+    }
+#if SR_NAK
+    r->nak_wait[index] = 0;
+#endif
+    r->recv_base = SEQ_NEXT(r->recv_base);
+  }
+  if (!old)
+    deliver_in_order(r);
+  if (TRACE > 1)
+    printf("----B: skip to %d, receive base is %d\n", seq, r->recv_base);
+  TRACE_EVENT(TR_SKIP, B, seq, r->recv_base, old ? TRF_DUP : 0);
+
+  reply = pkt_alloc();
+  reply->seqnum = SKIP;
+  reply->acknum = seq;
+  for (i = 0; i < 20 ; i++)
+    reply->payload[i] = '0';
+  reply->checksum = ComputeChecksum(reply);
+  send_packet(B, reply);
+  pkt_release(reply);
+}
+#endif
+
+#if SR_FEC
+/* rebuild the packet of a parity group that B is missing, if it misses
+   only one: its payload is the parity XOR the payloads of the others.
+   The group lies within the receive window and the WINDOWSIZE numbers
+   before it, whose payloads fec_data still holds.  The packet rebuilt is
+   then taken as if it had arrived, so it is ACKed and A does not send it
+   again. */
+static void fec_rebuild(struct receiver *r, const struct pkt *parity)
+{
+  struct pkt *rebuilt;
+  char payload[20];
+  int seq, missing = 0, nmissing = 0, k, i;
+
+  memcpy(payload, parity->payload, sizeof(payload));
+  for (k = 0, seq = parity->seqnum; k < SR_FEC; k++, seq = SEQ_NEXT(seq)) {
+    if (SEQ_IN_WINDOW(seq, r->recv_base, WINDOWSIZE)) {
+      if (!r->recv_status[recv_seq_to_index(seq)]) {
+        missing = seq;
+        nmissing++;
+        continue;
+      }
+    }
+    else if (SEQ_DIST(r->recv_base, seq) > WINDOWSIZE)
+      return;     /* a group older than the payloads kept */
+    for (i = 0; i < 20; i++)
+      payload[i] ^= r->fec_data[(unsigned int)seq % FEC_SLOTS][i];
+  }
+  if (nmissing != 1)
+    return;
+
+  if (TRACE > 1)
+    printf("----B: packet %d is rebuilt from parity\n", missing);
+  rebuilt = pkt_alloc();
+  rebuilt->seqnum = missing;
+  rebuilt->acknum = NOTINUSE;
+  memcpy(rebuilt->payload, payload, sizeof(rebuilt->payload));
+  rebuilt->checksum = ComputeChecksum(rebuilt);
+  stats.fec_rebuilt++;
+  B_input_ref(rebuilt);
+  pkt_release(rebuilt);
+}
+#endif
+
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+void B_input_ref(struct pkt *packet)
 {
-  struct pkt sendpkt;
+  struct receiver *r = &receivers[current_flow];
+  struct pkt *sendpkt;
   int i;
   int index;
-  
+#if SR_NAK
+  bool buffered_ahead = false;   /* a packet past the receive base was buffered */
+#endif
+
+#if SR_FEC
+  /* parity packets are not acknowledged */
+  if (packet->acknum == PARITY && !IsCorrupted(packet)) {
+    fec_rebuild(r, packet);
+    return;
+  }
+#endif
+#if SR_PARTIAL
+  /* skips are answered on their own */
+  if (packet->acknum == SKIP && !IsCorrupted(packet)) {
+    skip_forward(r, packet->seqnum);
+    return;
+  }
+#endif
+
+  sendpkt = pkt_alloc();
+
   /* Check if packet is corrupted */
   if (IsCorrupted(packet)) {
     if (TRACE > 1)
       printf("----B: packet corrupted, resend ACK!\n");
     
     /* First check if the packet is corrupted */
-    if (last_ack_sent != -1) {
-      sendpkt.acknum = last_ack_sent;
+    if (r->last_ack_sent != -1) {
+      sendpkt->acknum = r->last_ack_sent;
     } else {
-      /* If no packet has been correctly received yet, just use recv_base-1 */
-      sendpkt.acknum = (recv_base - 1 + SEQSPACE) % SEQSPACE;
+      /* If no packet has been correctly received yet, just use r->recv_base-1 */
+      sendpkt->acknum = SEQ_PREV(r->recv_base);
     }
+    TRACE_EVENT(TR_RECV_CORRUPT, B, -1, sendpkt->acknum, 0);
   }
   /* Then check if it's within the receive window */
   else {
     /* Count this packet as correctly received if it's not corrupted */
     packets_received++;
 
-    if (!in_recv_window(packet.seqnum)) {
+    if (!in_recv_window(r, packet->seqnum)) {
       /* If this is the packet just before the window, it's a duplicate we already processed */
-      if (packet.seqnum == ((recv_base - 1 + SEQSPACE) % SEQSPACE)) {
+      if (packet->seqnum == SEQ_PREV(r->recv_base)) {
         if (TRACE > 1)
-            printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
+            printf("----B: packet %d is correctly received, send ACK!\n", packet->seqnum);
         
         /* Send ACK for this packet since it's a duplicate of the last packet we delivered */
-        sendpkt.acknum = packet.seqnum;
-        last_ack_sent = packet.seqnum;
+        sendpkt->acknum = packet->seqnum;
+        r->last_ack_sent = packet->seqnum;
+        TRACE_EVENT(TR_RECV, B, packet->seqnum, sendpkt->acknum, TRF_DUP);
       } else {
         /* For any other packet outside the window, we need to send an ACK for the last packet */
         if (TRACE > 1)
-          printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
+          printf("----B: packet %d is correctly received, send ACK!\n", packet->seqnum);
         
-        if (last_ack_sent != -1) {
-          sendpkt.acknum = last_ack_sent;
+        if (r->last_ack_sent != -1) {
+          sendpkt->acknum = r->last_ack_sent;
         } else {
-          sendpkt.acknum = (recv_base - 1 + SEQSPACE) % SEQSPACE;
+          sendpkt->acknum = SEQ_PREV(r->recv_base);
         }
+        TRACE_EVENT(TR_RECV, B, packet->seqnum, sendpkt->acknum, TRF_DUP);
       }
     }
     else {
       if (TRACE > 1) 
-        printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
+        printf("----B: packet %d is correctly received, send ACK!\n", packet->seqnum);
 
-      index = recv_seq_to_index(packet.seqnum);
+      index = recv_seq_to_index(packet->seqnum);
+      TRACE_EVENT(TR_RECV, B, packet->seqnum, packet->seqnum, r->recv_status[index] ? TRF_DUP : 0);
 
       /* If we haven't received this packet before */
-      if (!recv_status[index]) {
-        /* Store packet in buffer */
-        recv_buffer[index] = packet;
-        recv_status[index] = true;
+      if (!r->recv_status[index]) {
+        /* Store packet in buffer: keep a reference instead of a copy */
+        pkt_hold(packet);
+        r->recv_buffer[index] = packet;
+        r->recv_status[index] = true;
+#if SR_FEC
+        memcpy(r->fec_data[(unsigned int)packet->seqnum % FEC_SLOTS], packet->payload, 20);
+#endif
       
         /* If this is the packet we're waiting for, deliver it and any consecutive buffered packets */
-        if (packet.seqnum == recv_base) {
-      
-          while (recv_status[recv_seq_to_index(recv_base)]) {
-            /* Deliver packet to layer 5 */
-            index = recv_seq_to_index(recv_base);
-            tolayer5(B, recv_buffer[index].payload);
-            
-            /* Mark buffer slot as empty */
-            recv_status[index] = false;
-            
-            /* Advance receive window */
-            recv_base = (recv_base + 1) % SEQSPACE;
-          }
-        }
+        if (packet->seqnum == r->recv_base)
+          deliver_in_order(r);
+#if SR_NAK
+        else
+          buffered_ahead = true;
+#endif
       } 
       
       /* Send ACK for this packet */
-      sendpkt.acknum = packet.seqnum;
-      last_ack_sent = packet.seqnum;
+      sendpkt->acknum = packet->seqnum;
+      r->last_ack_sent = packet->seqnum;
     }
   }
 
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+  sendpkt->seqnum = r->B_nextseqnum;
+  r->B_nextseqnum = (r->B_nextseqnum + 1) % 2;
     
   /* we don't have any data to send.  fill payload with 0's */
   for (i = 0; i < 20 ; i++) 
-    sendpkt.payload[i] = '0';  
+    sendpkt->payload[i] = '0';  
 
   /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt); 
+  sendpkt->checksum = ComputeChecksum(sendpkt); 
 
   /* send out packet */
-  tolayer3 (B, sendpkt);
+  send_packet(B, sendpkt);
+  pkt_release(sendpkt);
+
+#if SR_NAK
+  /* then ask at once for the packets missing before it */
+  if (buffered_ahead)
+    send_naks(r, packet->seqnum);
+#endif
+
+  /* everything in order has been delivered, so the slot at r->recv_base must be empty */
+  if (r->recv_status[recv_seq_to_index(r->recv_base)]) {
+    fprintf(stderr, "INVARIANT FAILED: packet %d buffered at receive base but not delivered\n", r->recv_base);
+    trace_ring_dump("undelivered packet at receive base");
+  }
+}
+
+/* by-value entry point kept for compatibility: the packet is copied into */
+/* a pool buffer since B_input_ref() may keep a reference to it */
+void B_input(struct pkt packet)
+{
+  struct pkt *p;
+
+  p = pkt_alloc();
+  *p = packet;
+  B_input_ref(p);
+  pkt_release(p);
 }
 
-/* the following routine will be called once (only) before any other */
-/* entity B routines are called. You can use it to do any initialization */
+/* the following routine will be called once (only) for each flow, with */
+/* current_flow set, before any other entity B routines are called. You  */
+/* can use it to do any initialization */
 void B_init(void)
 {
+  struct receiver *r;
   int i;
 
+  if (receivers == NULL) {
+    receivers = malloc(nflows * sizeof(struct receiver));
+    if (receivers == NULL) {
+      printf("memory allocation for receiver state failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  r = &receivers[current_flow];
+
   /* Initialize receiver variables */
-  recv_base = 0;
-  B_nextseqnum = 1;
-  last_ack_sent = -1;  /* Initialize to indicate no ACK sent yet */
+  r->recv_base = 0;
+  r->B_nextseqnum = 1;
+  r->last_ack_sent = -1;  /* Initialize to indicate no ACK sent yet */
 
   /* Initialize receiver buffer */
-  for (i = 0; i < WINDOWSIZE; i++) {
-      recv_status[i] = false;
+  for (i = 0; i < WINDOW_SLOTS; i++) {
+      r->recv_buffer[i] = NULL;
+      r->recv_status[i] = false;
+#if SR_NAK
+      r->nak_wait[i] = 0;
+#endif
+  }
+}
+
+/********* checkpoints ************/
+
+static const char ckpt_tag[4] = "SR";
+
+/* the build a checkpoint was made with, written after the tag: the state
+   is saved as it lies in memory, so it only fits the same build */
+struct ckpt_build {
+  unsigned int sender_size, receiver_size;   /* sizeof of the per flow state */
+  int windowsize, window_slots, seq32;
+  int nak, fec, pace, partial;
+};
+
+static void ckpt_this_build(struct ckpt_build *b)
+{
+  memset(b, 0, sizeof(*b));
+  b->sender_size = sizeof(struct sender);
+  b->receiver_size = sizeof(struct receiver);
+  b->windowsize = WINDOWSIZE;
+  b->window_slots = WINDOW_SLOTS;
+#ifdef SEQ32
+  b->seq32 = 1;
+#endif
+  b->nak = SR_NAK;
+  b->fec = SR_FEC;
+  b->pace = SR_PACE;
+  b->partial = SR_PARTIAL;
+}
+
+static void ckpt_print_build(const char *which, const struct ckpt_build *b)
+{
+  printf("  %s: WINDOWSIZE=%d (%d slots)%s SR_NAK=%d SR_FEC=%d SR_PACE=%d SR_PARTIAL=%d, "
+         "state %u + %u bytes per flow\n", which, b->windowsize, b->window_slots,
+         b->seq32 ? " SEQ32" : "", b->nak, b->fec, b->pace, b->partial,
+         b->sender_size, b->receiver_size);
+}
+
+/* buffers are saved as the packets in them; a recv_buffer slot only */
+/* holds a packet while its recv_status is set                       */
+void protocol_save(FILE *fp)
+{
+  struct ckpt_build build;
+  int i, j;
+
+  ckpt_write(fp, ckpt_tag, sizeof(ckpt_tag));
+  ckpt_this_build(&build);
+  ckpt_write(fp, &build, sizeof(build));
+  ckpt_write(fp, &stats, sizeof(stats));
+  for (i = 0; i < nflows; i++) {
+    ckpt_write(fp, &senders[i], sizeof(struct sender));
+    for (j = 0; j < WINDOW_SLOTS; j++)
+      ckpt_write_pkt(fp, senders[i].send_buffer[j]);
+    ckpt_write(fp, &receivers[i], sizeof(struct receiver));
+    for (j = 0; j < WINDOW_SLOTS; j++)
+      ckpt_write_pkt(fp, receivers[i].recv_status[j] ? receivers[i].recv_buffer[j] : NULL);
+  }
+}
+
+void protocol_restore(FILE *fp)
+{
+  char tag[sizeof(ckpt_tag)];
+  struct ckpt_build saved, build;
+  int i, j;
+
+  ckpt_read(fp, tag, sizeof(tag));
+  if (memcmp(tag, ckpt_tag, sizeof(tag)) != 0) {
+    printf("checkpoint was not made with SR\n");
+    exit(EXIT_FAILURE);
   }
+  ckpt_read(fp, &saved, sizeof(saved));
+  ckpt_this_build(&build);
+  if (memcmp(&saved, &build, sizeof(build)) != 0) {
+    printf("checkpoint was made with SR built with other options\n");
+    ckpt_print_build("checkpoint", &saved);
+    ckpt_print_build("this build", &build);
+    exit(EXIT_FAILURE);
+  }
+  ckpt_read(fp, &stats, sizeof(stats));
+  for (i = 0; i < nflows; i++) {
+    ckpt_read(fp, &senders[i], sizeof(struct sender));
+    for (j = 0; j < WINDOW_SLOTS; j++)
+      senders[i].send_buffer[j] = ckpt_read_pkt(fp);
+    ckpt_read(fp, &receivers[i], sizeof(struct receiver));
+    for (j = 0; j < WINDOW_SLOTS; j++)
+      receivers[i].recv_buffer[j] = ckpt_read_pkt(fp);
+  }
+}
+
+/********* statistics ************/
+
+/* the counters of the features built in, with the share of the packets
+   or messages they make up.  B sends an ACK for every packet it gets, so
+   whatever else it sends is NAKs and skip answers.  Messages A abandoned
+   may still have reached B, if only their ACKs were lost; the ones B
+   skipped are the messages lost for good.  The lines of a feature are
+   printed whenever it is built in, zeros included. */
+void protocol_print_stats(FILE *fp)
+{
+#if SR_NAK
+  fprintf(fp, "number of NAKs sent by B:  %d (%.1f%% of the %d packets B sent)\n",
+          stats.naks_sent,
+          stats.packets_sent[B] > 0 ? 100.0 * stats.naks_sent / stats.packets_sent[B] : 0.0,
+          stats.packets_sent[B]);
+  fprintf(fp, "number of packet resends by A on a NAK:  %d \n", stats.nak_resends);
+#endif
+#if SR_FEC
+  fprintf(fp, "number of parity packets sent by A:  %d (%.1f%% of the %d packets A sent)\n",
+          stats.fec_sent,
+          stats.packets_sent[A] > 0 ? 100.0 * stats.fec_sent / stats.packets_sent[A] : 0.0,
+          stats.packets_sent[A]);
+  fprintf(fp, "number of packets rebuilt from parity at B:  %d \n", stats.fec_rebuilt);
+#endif
+#if SR_PARTIAL
+  fprintf(fp, "number of messages abandoned by A:  %d (%.1f%% of the %d accepted)\n",
+          stats.msgs_abandoned,
+          stats.msgs_accepted > 0 ? 100.0 * stats.msgs_abandoned / stats.msgs_accepted : 0.0,
+          stats.msgs_accepted);
+  fprintf(fp, "number of skips sent by A:  %d \n", stats.skips_sent);
+  fprintf(fp, "number of messages skipped at B, never delivered:  %d \n", stats.msgs_skipped);
+#endif
 }
 
 /******************************************************************************
@@ -2,10 +2,20 @@ extern void A_init(void);
 extern void B_init(void);
 extern void A_input(struct pkt);
 extern void B_input(struct pkt);
+extern void A_input_ref(struct pkt *);  /* packet handle is only borrowed for the call */
+extern void B_input_ref(struct pkt *);
 extern void A_output(struct msg);
 extern void A_timerinterrupt(void);
 
 /* included for extension to bidirectional communication */
 #define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
 extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+extern void B_timerinterrupt(void);
+
+/* checkpoints (-C, -R): state of every flow, written and read with the */
+/* ckpt_ routines of emulator.h.  Restore runs after A_init()/B_init(). */
+extern void protocol_save(FILE *);
+extern void protocol_restore(FILE *);
+
+/* counters of the protocol's own, reported after the ones of emulator.h */
+extern void protocol_print_stats(FILE *);
\ No newline at end of file
@@ -0,0 +1,143 @@
+#!/bin/bash
+
+# Benchmark of the emulator with the SR and GBN protocols.
+#
+# Usage: ./sr_bench.sh [--save-baseline] [messages ...]
+#
+# Every scenario is run once per message count (default 100000, e.g.
+# "./sr_bench.sh 100000 1000000 10000000"), with the fixed seed of the
+# emulator, so all runs simulate exactly the same events.  Wall time,
+# events per second, peak memory and allocations are written to
+# bench_results/results.json and compared with bench_baseline.json: a run
+# below 80% of the baseline events per second, or with more allocations,
+# is reported as a regression.  --save-baseline makes the current results
+# the new baseline.  The baseline depends on the machine it was made on.
+#
+# The events are kept in a calendar queue; set QUEUE=list or QUEUE=heap to
+# measure the others.
+
+BASELINE=bench_baseline.json
+RESULTS=bench_results/results.json
+QUEUE=${QUEUE:-calendar}
+MIN_SPEED=80      # percent of the baseline events per second
+
+save_baseline=0
+counts=""
+for arg in "$@"; do
+    if [ "$arg" = "--save-baseline" ]; then
+        save_baseline=1
+    else
+        counts="$counts $arg"
+    fi
+done
+counts=${counts:-100000}
+
+# Create results directory
+mkdir -p bench_results
+
+# Compile both protocols with optimization
+echo -e "Compiling SR and GBN protocol implementations..."
+gcc -O2 -o bench_results/sr sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+(cd gbn && gcc -O2 -I.. -o ../bench_results/gbn gbn.c emulator.c ../eventq.c ../checksum.c ../trace.c -Wall -lm) || exit 1
+
+# value of key in a line of results.json
+field() {
+    echo "$1" | sed -n "s/.*\"$2\": \"\{0,1\}\([^\",}]*\).*/\1/p"
+}
+
+# Function to run one scenario and append its result to the results file
+run_bench() {
+    protocol=$1
+    scenario=$2
+    num_msgs=$3
+    loss_prob=$4
+    corrupt_prob=$5
+    direction=$6
+    lambda=$7
+
+    # No direction parameter needed if no loss/corruption
+    if [ "$loss_prob" = "0.0" ] && [ "$corrupt_prob" = "0.0" ]; then
+        input="$num_msgs $loss_prob $corrupt_prob $lambda 0"
+    else
+        input="$num_msgs $loss_prob $corrupt_prob $direction $lambda 0"
+    fi
+    stats=$(echo "$input" | ./bench_results/$protocol -b -q $QUEUE 2>/dev/null | grep -a "^BENCH")
+    if [ -z "$stats" ]; then
+        echo "$protocol $scenario $num_msgs: no statistics, run failed"
+        failed=1
+        return
+    fi
+
+    line=$(echo "$stats" | awk -v p="$protocol" -v s="$scenario" -v n="$num_msgs" -v q="$QUEUE" '{
+        printf "{\"protocol\": \"%s\", \"scenario\": \"%s\", \"messages\": %s, \"queue\": \"%s\"", p, s, n, q
+        for (i = 2; i <= NF; i++) {
+            split($i, kv, "=")
+            printf ", \"%s\": %s", kv[1], kv[2]
+        }
+        printf "}"
+    }')
+    [ -n "$lines" ] && lines="$lines,"$'\n'
+    lines="$lines  $line"
+    printf "%-4s %-12s %9s msgs  %8s s  %10s events/s  %8s KB  %10s allocations\n" \
+        $protocol $scenario $num_msgs $(field "$line" wall_s) $(field "$line" events_per_s) \
+        $(field "$line" peak_rss_kb) $(field "$line" allocations)
+}
+
+
+echo -e "\n--- Running Benchmarks (queue: $QUEUE) ---"
+lines=""
+failed=0
+for n in $counts; do
+    for protocol in sr gbn; do
+        run_bench $protocol clean       $n 0.0 0.0 0 10.0
+        run_bench $protocol loss10      $n 0.1 0.0 2 10.0
+        run_bench $protocol corrupt20   $n 0.0 0.2 2 10.0
+        run_bench $protocol window_full $n 0.0 0.0 0 1.0
+    done
+done
+printf "[\n%s\n]\n" "$lines" > $RESULTS
+echo "Results saved to $RESULTS"
+
+if [ $save_baseline = 1 ]; then
+    cp $RESULTS $BASELINE
+    echo "Baseline saved to $BASELINE"
+    exit $failed
+fi
+if [ ! -f $BASELINE ]; then
+    echo "No $BASELINE to compare with, create it with --save-baseline"
+    exit $failed
+fi
+
+# Compare with the baseline run of the same protocol, scenario, message
+# count and queue
+echo -e "\n--- Comparing with $BASELINE ---"
+regressions=0
+while read -r line; do
+    [ -n "$(field "$line" protocol)" ] || continue
+    key="\"protocol\": \"$(field "$line" protocol)\", \"scenario\": \"$(field "$line" scenario)\", \"messages\": $(field "$line" messages), \"queue\": \"$(field "$line" queue)\""
+    base=$(grep -F "$key" $BASELINE)
+    [ -n "$base" ] || continue
+    verdict=$(awk -v eps="$(field "$line" events_per_s)" -v beps="$(field "$base" events_per_s)" \
+                  -v al="$(field "$line" allocations)" -v bal="$(field "$base" allocations)" -v min=$MIN_SPEED '
+        BEGIN {
+            v = ""
+            if (eps < beps * min / 100)
+                v = sprintf("events/s %d is %.0f%% of baseline %d", eps, 100 * eps / beps, beps)
+            if (al > bal)
+                v = v (v == "" ? "" : ", ") sprintf("allocations %d > baseline %d", al, bal)
+            print v
+        }')
+    name="$(field "$line" protocol) $(field "$line" scenario) $(field "$line" messages)"
+    if [ -n "$verdict" ]; then
+        echo "REGRESSION $name: $verdict"
+        regressions=$((regressions + 1))
+    else
+        echo "ok         $name"
+    fi
+done < $RESULTS
+
+if [ $regressions -gt 0 ] || [ $failed = 1 ]; then
+    echo -e "\n--- $regressions regression(s) against $BASELINE ---"
+    exit 1
+fi
+echo -e "\n--- No regressions against $BASELINE ---"
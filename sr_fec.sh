@@ -0,0 +1,59 @@
+#!/bin/bash
+
+# SR with XOR parity (forward error correction) for several group sizes.
+#
+# Usage: ./sr_fec.sh [seed [k ...]]
+#
+# SR is built without parity and with -DSR_FEC=k for each k (default 2 3 4
+# 6), and every build runs the scenarios below with the same seed (default
+# 9999) and -s.  For each run the goodput (messages delivered per time
+# unit), the delay from layer 5 at A to layer 5 at B (mean and p99), the
+# resends by A, the parity packets and their share of what A sent (the
+# bandwidth overhead, 1/(k+1) of the new packets) and the packets B
+# rebuilt from parity are printed.
+
+SEED=${1:-9999}
+shift
+ks=${*:-2 3 4 6}
+OUT=bench_results
+
+mkdir -p $OUT
+gcc -O2 -o $OUT/sr_fec0 sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+for k in $ks; do
+    gcc -O2 -DSR_FEC=$k -o $OUT/sr_fec$k sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+done
+
+# messages, loss, corruption, direction, mean time between messages;
+# the loss rates of test6 and test7 in sr_tests.sh, on the data direction
+scenarios=(
+    "2000 0.1 0.0 0 50.0"
+    "2000 0.2 0.0 0 50.0"
+    "2000 0.1 0.1 0 50.0"
+    "2000 0.2 0.2 0 50.0"
+)
+
+# value after the first colon of the line of an output containing $2
+stat() {
+    echo "$1" | grep "$2" | sed 's/^[^:]*: *//; s/ .*//'
+}
+
+printf "%-22s %3s %9s %8s %8s %8s %8s %8s %8s\n" "scenario" "k" "goodput" "deliv" "mean" "p99" "resends" "parity" "rebuilt"
+for sc in "${scenarios[@]}"; do
+    for k in 0 $ks; do
+        out=$(echo "$sc 0" | $OUT/sr_fec$k -S $SEED -s 2>/dev/null)
+        t=$(echo "$out" | sed -n 's/.*Simulator terminated at time \([0-9.]*\).*/\1/p')
+        delivered=$(stat "$out" "delivered to application")
+        delay=$(echo "$out" | grep "mean .* p99\.9")
+        mean=$(echo "$delay" | sed 's/.*mean \([0-9.]*\).*/\1/')
+        p99=$(echo "$delay" | sed 's/.* p99 \([0-9.]*\).*/\1/')
+        if [ $k = 0 ]; then
+            parity=-; rebuilt=-
+        else
+            parity=$(echo "$out" | sed -n 's/.*parity packets sent by A: *\([0-9]*\) (\([0-9.]*%\).*/\1 \2/p')
+            rebuilt=$(stat "$out" "rebuilt from parity")
+        fi
+        goodput=$(awk -v d="$delivered" -v t="$t" 'BEGIN { printf "%.5f", (t > 0 ? d / t : 0) }')
+        printf "%-22s %3s %9s %8s %8.2f %8.2f %8s %8s %8s\n" "$sc" "$k" "$goodput" "$delivered" \
+            "$mean" "$p99" "$(stat "$out" "packet resends by A:")" "$parity" "$rebuilt"
+    done
+done
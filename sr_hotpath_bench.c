@@ -0,0 +1,438 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/* the protocol itself, so that its static helpers can be called directly */
+#include "sr.c"
+
+/* ******************************************************************
+   Micro-benchmark for the hot paths of the SR protocol in sr.c.
+
+   Build: gcc -O2 -o sr_hotpath_bench sr_hotpath_bench.c checksum.c trace.c
+   Usage: ./sr_hotpath_bench [calls per measurement]
+
+   The entry points are driven directly, without the emulator: layer 3,
+   layer 5 and the timers are stubs below, and packets come from a small
+   pool with the same reference counting as the emulator's.  Each stream
+   is a sequence of blocks of WINDOWSIZE packets, one block per window:
+
+   in-order     every packet once, in sequence order
+   reordered    each window in reverse order, so the last packet of a
+                block slides the window over all of it
+   duplicates   every packet three times
+   corrupted    every packet preceded by a corrupted copy
+
+   A_input gets the ACKs of the stream.  Before each block the sender is
+   restored from a copy taken with a full window at that base, so the
+   block acknowledges it all; the copy is a struct assignment, a few
+   percent of the cost.  "A_input slide" acknowledges the base of a window
+   whose other packets are all ACKed already, the longest slide there is.
+   B_input gets the data packets and keeps its state from block to block.
+
+   Costs are given in nanoseconds per call and, where the kernel lets us
+   open a hardware counter, in instructions per call.
+**********************************************************************/
+
+#define DEFAULT_CALLS 10000000
+#define DUPLICATES 3         /* copies of each packet in the duplicates stream */
+
+/********* stubs of the emulator ************/
+
+int TRACE = 0;
+int nflows = 1;
+int current_flow = 0;
+int window_full;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+
+static volatile int sink;   /* keeps results alive */
+
+struct pktbuf {
+  struct pkt pkt;           /* first member: a handle points to it */
+  int refcount;
+  struct pktbuf *nextfree;
+};
+
+static struct pktbuf *pktfree = NULL;
+
+struct pkt *pkt_alloc(void)
+{
+  struct pktbuf *b = pktfree;
+
+  if (b == NULL) {
+    b = malloc(sizeof(struct pktbuf));
+    if (b == NULL) {
+      printf("memory allocation for packet failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  else
+    pktfree = b->nextfree;
+  b->refcount = 1;
+  return &b->pkt;
+}
+
+void pkt_hold(struct pkt *packet)
+{
+  ((struct pktbuf *)packet)->refcount++;
+}
+
+void pkt_release(struct pkt *packet)
+{
+  struct pktbuf *b = (struct pktbuf *)packet;
+
+  if (--b->refcount == 0) {
+    b->nextfree = pktfree;
+    pktfree = b;
+  }
+}
+
+/* the medium drops everything; layer 3 would only take a reference */
+void tolayer3_ref(int AorB, struct pkt *packet)
+{
+  sink += packet->acknum;
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  sink += datasent[0];
+}
+
+void tolayer5_skip(int AorB)
+{
+}
+
+void starttimer(int AorB, double increment)
+{
+  sink++;
+}
+
+void stoptimer(int AorB)
+{
+  sink--;
+}
+
+/* the clock moves a round trip on at each reading, so that with SR_PACE
+   the token bucket has refilled by the next message and setup() fills
+   the window as without pacing */
+double get_sim_time(void)
+{
+  static double now = 0.0;
+
+  now += RTT;
+  return now;
+}
+
+/* checkpoints are not taken here */
+void ckpt_write(FILE *fp, const void *data, size_t len)
+{
+}
+
+void ckpt_read(FILE *fp, void *data, size_t len)
+{
+  memset(data, 0, len);
+}
+
+void ckpt_write_pkt(FILE *fp, const struct pkt *packet)
+{
+}
+
+struct pkt *ckpt_read_pkt(FILE *fp)
+{
+  return NULL;
+}
+
+void record_resends(int resends)
+{
+  sink += resends;
+}
+
+/********* packets and streams ************/
+
+struct stream {
+  const char *name;
+  int reverse;              /* each window in reverse order */
+  int copies;               /* times each packet is given */
+  int corrupt;              /* corrupted copy before each packet */
+};
+
+static const struct stream streams[] = {
+  { "in-order",   0, 1,          0 },
+  { "reordered",  1, 1,          0 },
+  { "duplicates", 0, DUPLICATES, 0 },
+  { "corrupted",  0, 1,          1 },
+};
+
+#define NSTREAMS (int)(sizeof(streams)/sizeof(streams[0]))
+#define MAX_BLOCK (WINDOWSIZE * (DUPLICATES + 1))
+
+static struct pkt *acks[SEQSPACE], *bad_acks[SEQSPACE];
+static struct pkt *data[SEQSPACE], *bad_data[SEQSPACE];
+
+/* sender with a full window starting at each base, and the same with */
+/* everything but the base ACKed                                       */
+static struct sender filled[SEQSPACE], acked[SEQSPACE];
+
+/* packets of one stream: SEQSPACE blocks, after which the window is */
+/* back where it started                                              */
+static struct pkt *ops[SEQSPACE * MAX_BLOCK];
+
+static struct pkt *make_pkt(int seqnum, int acknum, char fill, int corrupt)
+{
+  struct pkt *p = pkt_alloc();
+
+  p->seqnum = seqnum;
+  p->acknum = acknum;
+  memset(p->payload, fill, sizeof(p->payload));
+  p->checksum = ComputeChecksum(p);
+  if (corrupt)
+    p->payload[0] = 'Z';    /* as the emulator corrupts a packet */
+  return p;
+}
+
+/* fill ops from acks or data; returns the length of a block */
+static int build_stream(const struct stream *st, struct pkt **good, struct pkt **bad)
+{
+  int k, i, j, base, seq, n = 0;
+
+  for (k = 0; k < SEQSPACE; k++) {
+    base = k * WINDOWSIZE % SEQSPACE;
+    for (i = 0; i < WINDOWSIZE; i++) {
+      seq = (base + (st->reverse ? WINDOWSIZE - 1 - i : i)) % SEQSPACE;
+      if (st->corrupt)
+        ops[n++] = bad[seq];
+      for (j = 0; j < st->copies; j++)
+        ops[n++] = good[seq];
+    }
+  }
+  return n / SEQSPACE;
+}
+
+static void setup(void)
+{
+  struct msg message;
+  int base, i;
+
+  memset(message.data, 'a', sizeof(message.data));
+  for (i = 0; i < SEQSPACE; i++) {
+    acks[i] = make_pkt(0, i, '0', 0);
+    bad_acks[i] = make_pkt(0, i, '0', 1);
+    data[i] = make_pkt(i, NOTINUSE, 'a' + i, 0);
+    bad_data[i] = make_pkt(i, NOTINUSE, 'a' + i, 1);
+  }
+
+  A_init();
+  B_init();
+  for (base = 0; base < SEQSPACE; base++) {
+    A_init();
+    for (i = 0; i < base; i++) {
+      A_output(message);
+      A_input_ref(acks[i]);
+    }
+    for (i = 0; i < WINDOWSIZE; i++)
+      A_output(message);
+    filled[base] = senders[0];
+    /* the copy keeps the packets of the window */
+    for (i = 0; i < WINDOWSIZE; i++)
+      pkt_hold(filled[base].send_buffer[i]);
+    for (i = 1; i < WINDOWSIZE; i++)
+      A_input_ref(acks[(base + i) % SEQSPACE]);
+    acked[base] = senders[0];
+  }
+}
+
+/********* benchmarks, each returns the number of calls made ************/
+
+static long run_send_window(int stream, long ncalls)
+{
+  struct sender s = senders[0];
+  long n = 0;
+  int seq;
+
+  while (n < ncalls) {
+    s.send_base = n / SEQSPACE % SEQSPACE;
+    for (seq = 0; seq < SEQSPACE; seq++)
+      sink += in_send_window(&s, seq);
+    n += SEQSPACE;
+  }
+  return n;
+}
+
+static long run_recv_window(int stream, long ncalls)
+{
+  struct receiver r = receivers[0];
+  long n = 0;
+  int seq;
+
+  while (n < ncalls) {
+    r.recv_base = n / SEQSPACE % SEQSPACE;
+    for (seq = 0; seq < SEQSPACE; seq++)
+      sink += in_recv_window(&r, seq);
+    n += SEQSPACE;
+  }
+  return n;
+}
+
+static long run_a_input(int stream, long ncalls)
+{
+  int block, k, i;
+  long n = 0;
+
+  block = build_stream(&streams[stream], acks, bad_acks);
+  while (n < ncalls) {
+    for (k = 0; k < SEQSPACE; k++) {
+      senders[0] = filled[k * WINDOWSIZE % SEQSPACE];
+      for (i = 0; i < block; i++)
+        A_input_ref(ops[k * block + i]);
+    }
+    n += SEQSPACE * block;
+  }
+  return n;
+}
+
+static long run_a_slide(int stream, long ncalls)
+{
+  long n = 0;
+  int base;
+
+  while (n < ncalls) {
+    for (base = 0; base < SEQSPACE; base++) {
+      senders[0] = acked[base];
+      A_input_ref(acks[base]);
+    }
+    n += SEQSPACE;
+  }
+  return n;
+}
+
+static long run_b_input(int stream, long ncalls)
+{
+  int len, i;
+  long n = 0;
+
+  len = SEQSPACE * build_stream(&streams[stream], data, bad_data);
+  while (n < ncalls) {
+    for (i = 0; i < len; i++)
+      B_input_ref(ops[i]);
+    n += len;
+  }
+  return n;
+}
+
+/********* timing and hardware counters ************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int counter_fd = -1;   /* instructions retired, -1 if not available */
+
+static void counter_open(void)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  counter_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void counter_start(void)
+{
+#ifdef __linux__
+  if (counter_fd >= 0) {
+    ioctl(counter_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+}
+
+/* instructions since counter_start(), -1 if not available */
+static long long counter_stop(void)
+{
+  long long count = -1;
+
+#ifdef __linux__
+  if (counter_fd >= 0) {
+    ioctl(counter_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter_fd, &count, sizeof(count)) != sizeof(count))
+      count = -1;
+  }
+#endif
+  return count;
+}
+
+struct bench {
+  const char *name;
+  long (*run)(int stream, long ncalls);
+  int stream;
+};
+
+static struct bench benches[] = {
+  { "in_send_window",        run_send_window, 0 },
+  { "in_recv_window",        run_recv_window, 0 },
+  { "A_input in-order",      run_a_input,     0 },
+  { "A_input reordered",     run_a_input,     1 },
+  { "A_input duplicates",    run_a_input,     2 },
+  { "A_input corrupted",     run_a_input,     3 },
+  { "A_input slide",         run_a_slide,     0 },
+  { "B_input in-order",      run_b_input,     0 },
+  { "B_input reordered",     run_b_input,     1 },
+  { "B_input duplicates",    run_b_input,     2 },
+  { "B_input corrupted",     run_b_input,     3 },
+};
+
+int main(int argc, char **argv)
+{
+  long ncalls = DEFAULT_CALLS;
+  long n;
+  long long instructions;
+  double t0, t1;
+  size_t b;
+
+  if (argc > 1)
+    ncalls = atol(argv[1]);
+  if (ncalls < 1) {
+    printf("usage: %s [calls per measurement]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  setup();
+  counter_open();
+  printf("%-22s %10s %16s\n", "", "ns/call", "instructions/call");
+  for (b = 0; b < sizeof(benches)/sizeof(benches[0]); b++) {
+    benches[b].run(benches[b].stream, ncalls / 100 + 1);   /* warm up */
+    counter_start();
+    t0 = now();
+    n = benches[b].run(benches[b].stream, ncalls);
+    t1 = now();
+    instructions = counter_stop();
+    printf("%-22s %10.2f", benches[b].name, (t1 - t0) * 1e9 / n);
+    if (instructions >= 0)
+      printf(" %16.1f\n", (double)instructions / n);
+    else
+      printf(" %16s\n", "-");
+  }
+  if (counter_fd < 0)
+    printf("(instruction counts need perf events: see perf_event_paranoid)\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# SR with timeout-only recovery against SR with NAKs from the receiver.
+#
+# Usage: ./sr_nak.sh [seed]
+#
+# SR is built twice, as it is and with -DSR_NAK=1, and both run every
+# scenario below with the same seed (default 9999) and -s.  For each run
+# the delay from layer 5 at A to layer 5 at B (mean, p99 and max: a lost
+# packet holds up the messages after it until it is recovered), the
+# resends by A, the NAKs sent by B and, with NAKs, the packets B sent in
+# all are printed; B sends one ACK per packet it gets either way, so the
+# NAKs are the extra reverse traffic.
+
+SEED=${1:-9999}
+OUT=bench_results
+
+mkdir -p $OUT
+gcc -O2 -o $OUT/sr sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+gcc -O2 -DSR_NAK=1 -o $OUT/sr_nak sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+
+# messages, loss, corruption, direction, mean time between messages
+scenarios=(
+    "2000 0.05 0.0 0 50.0"
+    "2000 0.1 0.0 0 50.0"
+    "2000 0.2 0.0 0 50.0"
+    "2000 0.1 0.0 2 50.0"
+    "2000 0.0 0.1 0 50.0"
+)
+
+# value after the first colon of the line of an output containing $2, - without one
+stat() {
+    local v
+
+    v=$(echo "$1" | grep "$2" | sed 's/^[^:]*: *//; s/ .*//')
+    echo "${v:--}"
+}
+
+run() {
+    echo "$2 0" | $OUT/$1 -S $SEED -s 2>/dev/null
+}
+
+printf "%-22s %-8s %8s %8s %8s %8s %8s %8s %8s\n" "scenario" "sr" "deliv" "mean" "p99" "max" "resends" "naks" "from B"
+for sc in "${scenarios[@]}"; do
+    for bin in sr sr_nak; do
+        out=$(run $bin "$sc")
+        delay=$(echo "$out" | grep "mean .* p99\.9")
+        mean=$(echo "$delay" | sed 's/.*mean \([0-9.]*\).*/\1/')
+        p99=$(echo "$delay" | sed 's/.* p99 \([0-9.]*\).*/\1/')
+        max=$(echo "$delay" | sed 's/.*max \([0-9.]*\).*/\1/')
+        if [ $bin = sr ]; then
+            label=timeout; naks=-; from_b=-
+        else
+            label=nak; naks=$(stat "$out" "NAKs sent by B")
+            from_b=$(echo "$out" | sed -n 's/.*of the \([0-9]*\) packets B sent.*/\1/p')
+        fi
+        printf "%-22s %-8s %8s %8.2f %8.2f %8.2f %8s %8s %8s\n" "$sc" "$label" \
+            "$(stat "$out" "delivered to application")" "$mean" "$p99" "$max" \
+            "$(stat "$out" "packet resends by A:")" "$naks" "$from_b"
+    done
+done
@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# SR sending new packets at once against SR pacing them.
+#
+# Usage: ./sr_pace.sh [seed [interval ...]]
+#
+# SR is built as it is and with -DSR_PACE=1 for each pacing interval
+# (default 2.7, a window per RTT, and 5.5, about what the emulated channel
+# takes per packet), and every build runs the scenarios below with the
+# same seed (default 9999), -s and a binary trace.  For each run the
+# goodput (messages delivered per time unit), the messages dropped with a
+# full window, the delay from layer 5 at A to layer 5 at B (mean and p99,
+# counting the time a paced message waits at A), the resends by A and the
+# spurious ones among them are printed.  A resend is spurious when B
+# already had the packet: the trace shows it as a duplicate received at B.
+
+SEED=${1:-9999}
+shift
+intervals=${*:-2.7 5.5}
+OUT=bench_results
+
+mkdir -p $OUT
+gcc -O2 -o $OUT/sr sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+for iv in $intervals; do
+    gcc -O2 -DSR_PACE=1 -DPACE_INTERVAL=$iv -o $OUT/sr_pace$iv sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+done
+gcc -O2 -o $OUT/tracedump tracedump.c trace.c -Wall || exit 1
+
+# messages, loss, corruption, [direction,] mean time between messages
+# (the direction is only asked for with loss or corruption)
+scenarios=(
+    "2000 0.0 0.0 4.0"
+    "2000 0.0 0.0 8.0"
+    "2000 0.1 0.0 0 8.0"
+    "2000 0.1 0.0 0 16.0"
+    "2000 0.0 0.1 0 8.0"
+)
+
+# value after the first colon of the line of an output containing $2
+stat() {
+    echo "$1" | grep "$2" | sed 's/^[^:]*: *//; s/ .*//'
+}
+
+printf "%-20s %-10s %9s %8s %8s %8s %8s %8s %8s\n" "scenario" "sr" "goodput" "deliv" "dropped" "mean" "p99" "resends" "spurious"
+for sc in "${scenarios[@]}"; do
+    for bin in sr $(for iv in $intervals; do echo sr_pace$iv; done); do
+        out=$(echo "$sc 0" | $OUT/$bin -S $SEED -s -t $OUT/pace.trace 2>/dev/null)
+        t=$(echo "$out" | sed -n 's/.*Simulator terminated at time \([0-9.]*\).*/\1/p')
+        delivered=$(stat "$out" "delivered to application")
+        delay=$(echo "$out" | grep "mean .* p99\.9")
+        mean=$(echo "$delay" | sed 's/.*mean \([0-9.]*\).*/\1/')
+        p99=$(echo "$delay" | sed 's/.* p99 \([0-9.]*\).*/\1/')
+        spurious=$($OUT/tracedump -csv $OUT/pace.trace | grep -c ",recv,B,.*,1,[0-9]*$")
+        goodput=$(awk -v d="$delivered" -v t="$t" 'BEGIN { printf "%.5f", (t > 0 ? d / t : 0) }')
+        printf "%-20s %-10s %9s %8s %8s %8.2f %8.2f %8s %8s\n" "$sc" "$bin" "$goodput" "$delivered" \
+            "$(stat "$out" "dropped due to full window")" "$mean" "$p99" \
+            "$(stat "$out" "packet resends by A:")" "$spurious"
+    done
+done
+rm -f $OUT/pace.trace
@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# Fully reliable SR against SR with partial reliability for several budgets.
+#
+# Usage: ./sr_partial.sh [seed [budget ...]]
+#
+# SR is built as it is and with -DSR_PARTIAL=1 for each budget (default r2
+# r4 t48 t96): rN abandons a packet after N resends (PR_RETRIES=N), tN once
+# it has gone N time units without an ACK (PR_LIFETIME=N).  Every build runs
+# the scenarios below with the same seed (default 9999) and -s.  For each run
+# the messages delivered and dropped with a full window, the delay from
+# layer 5 at A to layer 5 at B (mean, p99 and max), the resends by A, the
+# messages A abandoned and those B skipped, never delivered, are printed.
+# Without partial reliability SR gives up on a packet after MAX_RETRANSMIT
+# resends all the same, but B is not told: if it never had the packet, it
+# waits for it for good.
+
+SEED=${1:-9999}
+shift
+budgets=${*:-r2 r4 t48 t96}
+OUT=bench_results
+
+mkdir -p $OUT
+gcc -O2 -o $OUT/sr sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+for b in $budgets; do
+    case $b in
+        r*) flag="-DPR_RETRIES=${b#r}" ;;
+        t*) flag="-DPR_LIFETIME=${b#t}" ;;
+        *) echo "budget $b is neither rN nor tN"; exit 1 ;;
+    esac
+    gcc -O2 -DSR_PARTIAL=1 $flag -o $OUT/sr_partial_$b sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm || exit 1
+done
+
+# messages, loss, corruption, direction, mean time between messages
+scenarios=(
+    "2000 0.1 0.0 0 20.0"
+    "2000 0.2 0.0 0 20.0"
+    "2000 0.2 0.0 2 20.0"
+    "2000 0.1 0.1 2 10.0"
+    "2000 0.3 0.3 2 10.0"
+)
+
+# value after the first colon of the line of an output containing $2
+stat() {
+    echo "$1" | grep "$2" | sed 's/^[^:]*: *//; s/ .*//'
+}
+
+printf "%-22s %-6s %8s %8s %8s %8s %8s %8s %8s %8s\n" "scenario" "budget" "deliv" "dropped" "mean" "p99" "max" "resends" "abandon" "skipped"
+for sc in "${scenarios[@]}"; do
+    for b in full $budgets; do
+        if [ $b = full ]; then bin=sr; else bin=sr_partial_$b; fi
+        out=$(echo "$sc 0" | $OUT/$bin -S $SEED -s 2>/dev/null)
+        delay=$(echo "$out" | grep "mean .* p99\.9")
+        mean=$(echo "$delay" | sed 's/.*mean \([0-9.]*\).*/\1/')
+        p99=$(echo "$delay" | sed 's/.* p99 \([0-9.]*\).*/\1/')
+        max=$(echo "$delay" | sed 's/.*max \([0-9.]*\).*/\1/')
+        if [ $b = full ]; then
+            abandoned=-; skipped=-
+        else
+            abandoned=$(stat "$out" "abandoned by A")
+            skipped=$(stat "$out" "never delivered")
+        fi
+        printf "%-22s %-6s %8s %8s %8.2f %8.2f %8.2f %8s %8s %8s\n" "$sc" "$b" \
+            "$(stat "$out" "delivered to application")" "$(stat "$out" "dropped due to full window")" \
+            "$mean" "$p99" "$max" "$(stat "$out" "packet resends by A:")" "${abandoned:-0}" "${skipped:-0}"
+    done
+done
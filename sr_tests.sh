@@ -5,7 +5,7 @@ mkdir -p test_results
 
 # Compile SR protocol implementation
 echo -e "Compiling SR protocol implementation..."
-gcc -o sr sr.c emulator.c -Wall
+gcc -o sr sr.c emulator.c eventq.c checksum.c trace.c -Wall -lm
 
 # Function to run a test and save results with parameters
 run_test() {
@@ -0,0 +1,619 @@
+#define _GNU_SOURCE     /* pthread_setaffinity_np, sched_getcpu */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "emulator.h"
+#include "checksum.h"
+#include "eventq.h"     /* event types, for the trace */
+#include "trace.h"
+#include "sr.h"         /* gbn.h declares the same entry points */
+
+/* ******************************************************************
+   Threaded runtime: runs the unchanged SR or GBN entities with A and B
+   on two threads, each pinned to its own core (Linux only).
+
+   Build: gcc -O2 -pthread -o sr_threads sr.c thread_runtime.c checksum.c trace.c -Wall
+          (from ./gbn: gcc -O2 -pthread -I.. -o gbn_threads gbn.c
+           ../thread_runtime.c ../checksum.c ../trace.c -Wall)
+   Usage: ./sr_threads [-c sum|inet|crc32c] [-p cpuA,cpuB] [-u usec]
+
+   Layer 3 is a lock-free single producer, single consumer ring per
+   direction: A pushes onto rings[A] and B pops from it, B pushes onto
+   rings[B] and A pops from it.  The producer applies the loss and
+   corruption probabilities as it pushes, with its own random number
+   generator, and a full ring drops the packet as a network would.  Each
+   thread polls its incoming ring and its own timer, so A's window logic
+   runs while B is taking packets and sending ACKs at the same time.
+   A thread that finds nothing to do for SPIN_LIMIT polls yields the cpu.
+
+   The parameters are read from stdin as by the emulator, and messages
+   are offered as by the UDP runtime: with an average time between
+   messages of 0 the window is kept full, otherwise a message is offered
+   every lambda time units, one time unit being -u microseconds.  The
+   run ends once every message has been offered and A's timer is not
+   running.  The trace ring is per thread; trace files are not written.
+**********************************************************************/
+
+#define DEFAULT_UNIT_US 100
+#define IDLE_UNITS      200      /* time units without traffic that end the run */
+#define SENT_RING       65536    /* messages in flight whose send time is kept */
+#define RING_SIZE       1024     /* packets per direction, power of two */
+#define SPIN_LIMIT      1000     /* empty polls before a thread yields */
+#define CACHE_LINE      64
+
+int TRACE = 0;
+int nflows = 1;           /* one A/B pair */
+int current_flow = 0;
+
+/* statistics updated by the protocols: B only touches packets_received,
+   and the protocol keeps the counters of its own apart for A and B */
+int window_full;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+
+static int nsim = 0;              /* messages offered and taken, or dropped */
+static int nsimmax = 0;
+static float lossprob;
+static float corruptprob;
+static int corruptdirection;
+static float lambda;
+static long unit_ns = DEFAULT_UNIT_US * 1000L;
+static int cpus[2] = { 0, 1 };    /* cores of A and B */
+
+/* one direction of layer 3; the producer's and the consumer's fields */
+/* are on separate cache lines                                        */
+struct ring {
+  _Alignas(CACHE_LINE) atomic_uint tail;   /* next slot to fill, written by the producer */
+  unsigned int head_seen;                  /* head when the producer last looked */
+  unsigned int rng;                        /* producer's random state */
+  int affected;                            /* loss and corruption apply this way */
+  long pushed, lost, corrupted, full;
+  _Alignas(CACHE_LINE) atomic_uint head;   /* next slot to take, written by the consumer */
+  unsigned int tail_seen;                  /* tail when the consumer last looked */
+  _Alignas(CACHE_LINE) struct pkt slots[RING_SIZE];
+};
+
+static struct ring rings[2];      /* rings[A] carries A's packets to B */
+
+/* state of the thread running one entity */
+struct entity {
+  _Alignas(CACHE_LINE) int timer_running;
+  double timer_at;                /* clock when the timer goes off */
+  double last_activity;
+  int cpu;                        /* where the thread ran last */
+};
+
+static struct entity entities[2];
+static atomic_int stop;
+static pthread_barrier_t ready;
+
+static double started;            /* clock at the start of the run */
+static double last_delivery;      /* clock at the last delivery to layer 5 */
+static double idle_s;             /* seconds without traffic that end the run */
+static int messages_delivered;
+static int refused;               /* offers the window refused (lambda 0) */
+static double sent_at[SENT_RING];    /* when message n was taken by A */
+static int sent_num[SENT_RING];      /* n, to match a delivery */
+static double *latency;              /* of every delivered message, seconds */
+static long nlatency;
+static long unmatched;               /* deliveries without a known send time */
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/************************** PACKET POOL ***************/
+/* as in the emulator, but one pool per thread: packets cross between */
+/* the threads by value, in the ring slots                            */
+struct pktbuf {
+  struct pkt pkt;
+  int refcount;
+  struct pktbuf *nextfree;
+};
+
+#define PKTPOOL_CHUNK 64
+
+static _Thread_local struct pktbuf *pktfree = NULL;
+
+struct pkt *pkt_alloc(void)
+{
+  struct pktbuf *b;
+  int i;
+
+  if (pktfree == NULL) {
+    b = malloc(PKTPOOL_CHUNK * sizeof(struct pktbuf));
+    if (b == NULL) {
+      printf("memory allocation for packet pool failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<PKTPOOL_CHUNK; i++) {
+      b[i].nextfree = pktfree;
+      pktfree = &b[i];
+    }
+  }
+  b = pktfree;
+  pktfree = b->nextfree;
+  b->refcount = 1;
+  return &b->pkt;
+}
+
+void pkt_hold(struct pkt *packet)
+{
+  ((struct pktbuf *)packet)->refcount++;
+}
+
+void pkt_release(struct pkt *packet)
+{
+  struct pktbuf *b = (struct pktbuf *)packet;
+
+  if (--b->refcount == 0) {
+    b->nextfree = pktfree;
+    pktfree = b;
+  }
+}
+
+/************************** LAYER 3 RINGS ***************/
+
+static double ring_rand(struct ring *r)
+{
+  r->rng ^= r->rng << 13;        /* xorshift32 */
+  r->rng ^= r->rng >> 17;
+  r->rng ^= r->rng << 5;
+  return r->rng / 4294967296.0;
+}
+
+static void ring_init(int AorB)
+{
+  struct ring *r = &rings[AorB];
+
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  r->rng = 9999 + AorB;
+  r->affected = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+}
+
+/* called by the producer only */
+static void ring_push(int AorB, const struct pkt *packet)
+{
+  struct ring *r = &rings[AorB];
+  struct pkt *slot;
+  unsigned int tail;
+
+  r->pushed++;
+  if (r->affected && ring_rand(r) < lossprob) {
+    r->lost++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    TRACE_EVENT(TR_LOST, AorB, packet->seqnum, packet->acknum, 0);
+    return;
+  }
+  tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  if (tail - r->head_seen == RING_SIZE) {
+    r->head_seen = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail - r->head_seen == RING_SIZE) {
+      r->full++;
+      return;
+    }
+  }
+  slot = &r->slots[tail & (RING_SIZE - 1)];
+  *slot = *packet;
+  if (r->affected && ring_rand(r) < corruptprob) {
+    r->corrupted++;
+    slot->payload[0] = 'Z';
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being corrupted\n");
+    TRACE_EVENT(TR_CORRUPT, AorB, slot->seqnum, slot->acknum, 0);
+  }
+  TRACE_EVENT(TR_TOLAYER3, AorB, slot->seqnum, slot->acknum, 0);
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/* called by the consumer only; returns 0 if the ring is empty */
+static int ring_pop(int AorB, struct pkt *packet)
+{
+  struct ring *r = &rings[AorB];
+  unsigned int head;
+
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head == r->tail_seen) {
+    r->tail_seen = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head == r->tail_seen)
+      return 0;
+  }
+  *packet = r->slots[head & (RING_SIZE - 1)];
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return 1;
+}
+
+/************************** LAYER 3 AND 5 ***************/
+
+/* the packet is copied into the ring, so the caller keeps it */
+void tolayer3_ref(int AorB, struct pkt *packet)
+{
+  ring_push(AorB, packet);
+}
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  ring_push(AorB, &packet);
+}
+
+/* runs on B's thread; A wrote sent_at before the packet was pushed */
+void tolayer5(int AorB, char datasent[20])
+{
+  char num[11];
+  int n;
+
+  if (TRACE>2)
+    printf("          TOLAYER5: data received by application at %c: %.20s\n", AorB == A ? 'A' : 'B', datasent);
+  TRACE_EVENT(TR_TOLAYER5, AorB, -1, -1, 0);
+  messages_delivered++;
+  last_delivery = now();
+  memcpy(num, datasent, 10);
+  num[10] = '\0';
+  n = atoi(num);
+  if (sent_num[n % SENT_RING] == n && sent_at[n % SENT_RING] > 0.0) {
+    latency[nlatency++] = last_delivery - sent_at[n % SENT_RING];
+    sent_at[n % SENT_RING] = 0.0;      /* a duplicate delivery is not timed again */
+  }
+  else
+    unmatched++;
+}
+
+/* messages are timed by the number they carry, so a skipped one is only traced */
+void tolayer5_skip(int AorB)
+{
+  if (TRACE>2)
+    printf("          TOLAYER5: message skipped at %c\n", AorB == A ? 'A' : 'B');
+}
+
+/************************** TIMERS ***************/
+/* each entity's timer is only used by its own thread */
+
+void starttimer(int AorB, double increment)
+{
+  struct entity *e = &entities[AorB];
+
+  if (TRACE>1)
+    printf("          START TIMER: starting timer\n");
+  TRACE_EVENT(TR_TIMER_START, AorB, -1, -1, 0);
+  if (e->timer_running) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  e->timer_at = now() + increment * unit_ns / 1e9;
+  e->timer_running = 1;
+}
+
+void stoptimer(int AorB)
+{
+  struct entity *e = &entities[AorB];
+
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer\n");
+  TRACE_EVENT(TR_TIMER_STOP, AorB, -1, -1, 0);
+  if (!e->timer_running) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  e->timer_running = 0;
+}
+
+/* time since the start, in time units */
+double get_sim_time(void)
+{
+  return (now() - started) * 1e9 / unit_ns;
+}
+
+/* checkpoints belong to the emulator */
+void ckpt_write(FILE *fp, const void *data, size_t len)
+{
+  printf("checkpoints are not supported by the threaded runtime\n");
+  exit(EXIT_FAILURE);
+}
+
+void ckpt_read(FILE *fp, void *data, size_t len)
+{
+  ckpt_write(fp, data, len);
+}
+
+void ckpt_write_pkt(FILE *fp, const struct pkt *packet)
+{
+  ckpt_write(fp, NULL, 0);
+}
+
+struct pkt *ckpt_read_pkt(FILE *fp)
+{
+  ckpt_write(fp, NULL, 0);
+  return NULL;
+}
+
+/* resends per packet are only sampled by the emulator (-s) */
+void record_resends(int resends)
+{
+}
+
+/************************** LAYER 5 ***************/
+
+/* message n: its number in ten digits, then letters */
+static void make_msg(struct msg *m, int n)
+{
+  char num[11];
+  int i;
+
+  snprintf(num, sizeof(num), "%010d", n);
+  memcpy(m->data, num, 10);
+  for (i=10; i<20; i++)
+    m->data[i] = 'a' + n % 26;
+}
+
+/* hand message nsim to A; returns 0 if the window refused it */
+static int offer(void)
+{
+  struct msg m;
+  int before = window_full;
+
+  make_msg(&m, nsim);
+  sent_num[nsim % SENT_RING] = nsim;
+  sent_at[nsim % SENT_RING] = now();
+  TRACE_EVENT(TR_EVENT, A, -1, -1, FROM_LAYER5);
+  A_output(m);
+  return window_full == before;
+}
+
+/* offer the messages due at t; returns the number taken.  With lambda */
+/* 0 the window can only have opened if A has just handled an event.   */
+static int offer_due(double t, int handled)
+{
+  static double next_offer;
+  static int first = 1;
+  int n = 0;
+
+  if (lambda == 0.0) {
+    if (!handled && !first)
+      return 0;
+    first = 0;
+    /* keep the window full, retrying refused messages later */
+    while (nsim < nsimmax) {
+      if (!offer()) {
+        window_full--;      /* not dropped: it is offered again */
+        refused++;
+        sent_at[nsim % SENT_RING] = 0.0;
+        break;
+      }
+      nsim++;
+      n++;
+    }
+    return n;
+  }
+  if (next_offer == 0.0)
+    next_offer = t;
+  while (nsim < nsimmax && t >= next_offer) {
+    offer();                /* the protocol counts a refused message */
+    nsim++;
+    n++;
+    next_offer += lambda * unit_ns / 1e9;
+  }
+  return n;
+}
+
+/************************** THREADS ***************/
+
+static void pin(int AorB)
+{
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpus[AorB], &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    printf("cannot pin %c to cpu %d, left to the scheduler\n", AorB == A ? 'A' : 'B', cpus[AorB]);
+}
+
+static void *entity_thread(void *arg)
+{
+  int AorB = (int)(intptr_t)arg;
+  struct entity *e = &entities[AorB];
+  struct pkt buf, *p;
+  double t;
+  int busy, idle = 0;
+
+  pin(AorB);
+  pthread_barrier_wait(&ready);
+  e->last_activity = now();
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    busy = 0;
+    t = now();
+    trace_time = (t - started) * 1e9 / unit_ns;
+    while (ring_pop(1 - AorB, &buf)) {
+      p = pkt_alloc();
+      *p = buf;
+      TRACE_EVENT(TR_EVENT, AorB, -1, -1, FROM_LAYER3);
+      if (AorB == A)
+        A_input_ref(p);
+      else
+        B_input_ref(p);
+      pkt_release(p);
+      busy = 1;
+    }
+    if (e->timer_running && t >= e->timer_at) {
+      e->timer_running = 0;
+      TRACE_EVENT(TR_EVENT, AorB, -1, -1, TIMER_INTERRUPT);
+      if (AorB == A)
+        A_timerinterrupt();
+      else
+        B_timerinterrupt();
+      busy = 1;
+    }
+    if (AorB == A) {
+      if (offer_due(t, busy) > 0)
+        busy = 1;
+      /* everything sent has been acknowledged or given up */
+      if (nsim == nsimmax && !e->timer_running)
+        atomic_store(&stop, 1);
+      else if (!busy && t - e->last_activity > idle_s) {
+        printf("no traffic for %.0f ms, stopping\n", idle_s * 1000);
+        atomic_store(&stop, 1);
+      }
+    }
+    if (busy) {
+      e->last_activity = t;
+      idle = 0;
+    }
+    else if (++idle > SPIN_LIMIT)
+      sched_yield();
+  }
+  e->cpu = sched_getcpu();
+  return NULL;
+}
+
+/************************** SETUP AND REPORT ***************/
+
+static void init(void)
+{
+  printf("-----  Threaded runtime -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [0.0 for as fast as the window allows]:");
+  scanf("%f",&lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+
+  latency = malloc((nsimmax > 0 ? nsimmax : 1) * sizeof(double));
+  if (latency == NULL) {
+    printf("memory allocation for latencies failed.");
+    exit(EXIT_FAILURE);
+  }
+  idle_s = IDLE_UNITS * unit_ns / 1e9;
+  if (idle_s < 2 * lambda * unit_ns / 1e9)
+    idle_s = 2 * lambda * unit_ns / 1e9;
+  if (idle_s < 0.01)
+    idle_s = 0.01;
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [options] < parameters\n", prog);
+  printf("  -c kernel   checksum used by the protocol entities (default sum)\n");
+  printf("  -p a,b      cores for the A and B threads (default 0,1)\n");
+  printf("  -u usec     real time of one time unit (default %d)\n", DEFAULT_UNIT_US);
+  exit(EXIT_FAILURE);
+}
+
+static void parseargs(int argc, char **argv)
+{
+  int i;
+
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+      if (checksum_select(argv[++i]) < 0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-p") == 0 && i+1 < argc) {
+      if (sscanf(argv[++i], "%d,%d", &cpus[A], &cpus[B]) != 2 || cpus[A] < 0 || cpus[B] < 0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-u") == 0 && i+1 < argc) {
+      unit_ns = (long)(atof(argv[++i]) * 1000);
+      if (unit_ns < 1)
+        usage(argv[0]);
+    }
+    else
+      usage(argv[0]);
+  }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(double p)
+{
+  long i = (long)(p * nlatency + 0.999999) - 1;
+
+  if (i < 0)
+    i = 0;
+  return latency[i];
+}
+
+static void print_stats(double wall)
+{
+  int i;
+
+  printf(" Runtime stopped after %f s\n after attempting to send %d msgs from layer5\n", now() - started, nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  printf("number of correct packets received at B:  %d \n", packets_received);
+  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  protocol_print_stats(stdout);
+  if (lambda == 0.0)
+    printf("messages offered again after the window refused them:  %d \n", refused);
+  for (i=A; i<=B; i++)
+    printf("ring %c->%c: %ld packets, %ld lost and %ld corrupted on purpose, %ld dropped with the ring full\n",
+           i == A ? 'A' : 'B', i == A ? 'B' : 'A', rings[i].pushed, rings[i].lost, rings[i].corrupted, rings[i].full);
+  printf("threads: A on cpu %d, B on cpu %d\n", entities[A].cpu, entities[B].cpu);
+  printf("throughput: %.0f messages/s delivered in %.3f s\n", wall > 0.0 ? messages_delivered / wall : 0.0, wall);
+  if (nlatency > 0) {
+    qsort(latency, nlatency, sizeof(double), cmp_double);
+    printf("latency (us): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+           percentile(0.5) * 1e6, percentile(0.9) * 1e6, percentile(0.99) * 1e6,
+           percentile(0.999) * 1e6, latency[nlatency - 1] * 1e6);
+  }
+  if (unmatched > 0)
+    printf("deliveries without a send time: %ld\n", unmatched);
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t threads[2];
+  struct pkt warmup;
+  int i;
+
+  parseargs(argc, argv);
+  init();
+  /* the clock starts before the entities, which may read it in A_init */
+  started = last_delivery = now();
+  A_init();
+  B_init();
+  for (i=A; i<=B; i++)
+    ring_init(i);
+  /* the checksum kernels set up their tables on first use */
+  memset(&warmup, 0, sizeof(warmup));
+  pkt_checksum(&warmup);
+
+  pthread_barrier_init(&ready, NULL, 3);
+  for (i=A; i<=B; i++)
+    if (pthread_create(&threads[i], NULL, entity_thread, (void *)(intptr_t)i) != 0) {
+      printf("cannot create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  pthread_barrier_wait(&ready);
+  for (i=A; i<=B; i++)
+    pthread_join(threads[i], NULL);
+  pthread_barrier_destroy(&ready);
+
+  print_stats(last_delivery - started);
+  return EXIT_SUCCESS;
+}
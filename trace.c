@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+/* ******************************************************************
+   Binary event trace writer and record formatting.  See trace.h.
+**********************************************************************/
+
+#define TRACE_BLOCK 4096   /* records buffered before a write */
+
+int trace_enabled = 0;
+_Thread_local double trace_time = 0.0;
+int trace_flow = 0;
+_Thread_local struct trace_rec trace_ring[TRACE_RING_SIZE];
+_Thread_local unsigned int trace_ring_next = 0;
+_Thread_local unsigned int trace_ring_dumped = 0;
+
+static FILE *trace_fp = NULL;
+static struct trace_rec trace_block[TRACE_BLOCK];
+static int trace_count = 0;     /* records waiting in trace_block */
+
+static const char *type_names[TR_NTYPES] = {
+  "event", "tolayer3", "lost", "corrupt", "tolayer5", "timer_start",
+  "timer_stop", "send", "window_full", "ack", "ack_corrupt", "timeout",
+  "resend", "recv", "recv_corrupt", "window_slide", "giveup", "nak_send",
+  "nak", "skip_send", "skip"
+};
+
+static void trace_flush(void)
+{
+  if (trace_count > 0 && fwrite(trace_block, sizeof(struct trace_rec), trace_count, trace_fp) != (size_t)trace_count) {
+    printf("writing trace file failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  trace_count = 0;
+}
+
+int trace_open(const char *path)
+{
+  struct trace_header hdr;
+
+  trace_fp = fopen(path, "wb");
+  if (trace_fp == NULL)
+    return -1;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  hdr.version = TRACE_VERSION;
+  hdr.recsize = sizeof(struct trace_rec);
+  if (fwrite(&hdr, sizeof(hdr), 1, trace_fp) != 1) {
+    fclose(trace_fp);
+    trace_fp = NULL;
+    return -1;
+  }
+  trace_count = 0;
+  trace_enabled = 1;
+  return 0;
+}
+
+void trace_close(void)
+{
+  if (trace_fp == NULL)
+    return;
+  trace_flush();
+  fclose(trace_fp);
+  trace_fp = NULL;
+  trace_enabled = 0;
+}
+
+void trace_write(const struct trace_rec *r)
+{
+  trace_block[trace_count] = *r;
+  if (++trace_count == TRACE_BLOCK)
+    trace_flush();
+}
+
+/* print the ring to stderr, oldest record first.  Records already shown */
+/* by an earlier dump are skipped so repeated failures stay readable.    */
+void trace_ring_dump(const char *why)
+{
+  unsigned int n, i;
+
+  n = trace_ring_next - trace_ring_dumped;   /* modulo 2^32, so wrap safe */
+  if (n > TRACE_RING_SIZE)
+    n = TRACE_RING_SIZE;
+  fprintf(stderr, "==== trace ring: %u events before %s at time %f ====\n",
+          n, why, trace_time);
+  for (i = trace_ring_next - n; i != trace_ring_next; i++)
+    trace_print(stderr, &trace_ring[i & (TRACE_RING_SIZE - 1)]);
+  fprintf(stderr, "==== end of trace ring ====\n");
+  trace_ring_dumped = trace_ring_next;
+}
+
+/********************* decoding *************************/
+
+const char *trace_type_name(int type)
+{
+  if (type < 0 || type >= TR_NTYPES)
+    return "unknown";
+  return type_names[type];
+}
+
+/* print a record the way the TRACE printfs would have shown it */
+void trace_print(FILE *out, const struct trace_rec *r)
+{
+  char who = 'A' + r->entity;
+
+  switch (r->type) {
+  case TR_EVENT:
+    fprintf(out, "\nEVENT time: %f,  type: %d", r->time, r->flags);
+    if (r->flags == 0)
+      fprintf(out, ", timerinterrupt  ");
+    else if (r->flags == 1)
+      fprintf(out, ", fromlayer5 ");
+    else
+      fprintf(out, ", fromlayer3 ");
+    fprintf(out, " entity: %d", r->entity);
+    if (r->flow != 0)
+      fprintf(out, " flow: %u", r->flow);
+    fprintf(out, "\n");
+    break;
+  case TR_TOLAYER3:
+    fprintf(out, "          TOLAYER3: %c sends seq: %d, ack %d\n", who, r->seq, r->ack);
+    break;
+  case TR_LOST:
+    fprintf(out, "          TOLAYER3: packet being lost\n");
+    break;
+  case TR_CORRUPT:
+    fprintf(out, "          TOLAYER3: packet being corrupted\n");
+    break;
+  case TR_TOLAYER5:
+    fprintf(out, "          TOLAYER5: data received by application at %c\n", who);
+    break;
+  case TR_TIMER_START:
+    fprintf(out, "          START TIMER: starting timer at %f\n", r->time);
+    break;
+  case TR_TIMER_STOP:
+    fprintf(out, "          STOP TIMER: stopping timer at %f\n", r->time);
+    break;
+  case TR_SEND:
+    fprintf(out, "Sending packet %d to layer 3\n", r->seq);
+    break;
+  case TR_WINDOW_FULL:
+    fprintf(out, "----%c: New message arrives, send window is full\n", who);
+    break;
+  case TR_ACK:
+    fprintf(out, "----%c: uncorrupted ACK %d is received\n", who, r->ack);
+    if (r->flags & TRF_DUP)
+      fprintf(out, "----%c: ACK %d is a duplicate\n", who, r->ack);
+    else
+      fprintf(out, "----%c: ACK %d is not a duplicate\n", who, r->ack);
+    break;
+  case TR_ACK_CORRUPT:
+    fprintf(out, "----%c: corrupted ACK is received, do nothing!\n", who);
+    break;
+  case TR_TIMEOUT:
+    fprintf(out, "----%c: time out,resend packets!\n", who);
+    break;
+  case TR_RESEND:
+    fprintf(out, "---%c: resending packet %d\n", who, r->seq);
+    break;
+  case TR_RECV:
+    if (r->flags & TRF_DUP)
+      fprintf(out, "----%c: packet %d is a duplicate or out of window, send ACK %d!\n", who, r->seq, r->ack);
+    else
+      fprintf(out, "----%c: packet %d is correctly received, send ACK!\n", who, r->seq);
+    break;
+  case TR_RECV_CORRUPT:
+    fprintf(out, "----%c: packet corrupted, resend ACK %d!\n", who, r->ack);
+    break;
+  case TR_WINDOW_SLIDE:
+    fprintf(out, "----%c: send window slides to %d\n", who, r->seq);
+    break;
+  case TR_GIVEUP:
+    fprintf(out, "----%c: Packet %d given up on (retries or budget)\n", who, r->seq);
+    break;
+  case TR_NAK_SEND:
+    fprintf(out, "----%c: packet %d is missing, send NAK!\n", who, r->seq);
+    break;
+  case TR_NAK:
+    if (r->flags & TRF_DUP)
+      fprintf(out, "----%c: NAK %d is received, not resent\n", who, r->seq);
+    else
+      fprintf(out, "----%c: NAK %d is received, resending packet\n", who, r->seq);
+    break;
+  case TR_SKIP_SEND:
+    if (r->flags & TRF_DUP)
+      fprintf(out, "----%c: tell B to skip to %d again\n", who, r->seq);
+    else
+      fprintf(out, "----%c: tell B to skip to %d\n", who, r->seq);
+    break;
+  case TR_SKIP:
+    if (r->flags & TRF_DUP)
+      fprintf(out, "----%c: skip to %d is an old one, receive base is %d\n", who, r->seq, r->ack);
+    else
+      fprintf(out, "----%c: skip to %d, receive base is %d\n", who, r->seq, r->ack);
+    break;
+  default:
+    fprintf(out, "%f: unknown record type %d\n", r->time, r->type);
+  }
+}
+
+void trace_print_csv(FILE *out, const struct trace_rec *r)
+{
+  fprintf(out, "%f,%s,%c,%d,%d,%d,%u\n", r->time, trace_type_name(r->type),
+          'A' + r->entity, r->seq, r->ack, r->flags, r->flow);
+}
@@ -0,0 +1,98 @@
+/* ******************************************************************
+   Binary event trace.
+
+   The emulator and the protocol entities record one fixed size record
+   per event.  The most recent TRACE_RING_SIZE records are always kept in
+   an in-memory ring, which is dumped after a failure (trace_ring_dump).
+   When a trace file is opened (emulator option -t), every record is also
+   buffered and written out in blocks; tracedump.c turns a trace file
+   back into the usual TRACE style output or CSV.
+
+   The ring and the current time belong to the thread that records, so
+   a runtime with A and B on separate threads (thread_runtime.c) needs
+   no locking.  The trace file is shared and only for single threaded
+   use.
+**********************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+
+/* event types */
+#define TR_EVENT         0   /* emulator dispatches an event, flags = event type */
+#define TR_TOLAYER3      1   /* packet scheduled for arrival at the other side */
+#define TR_LOST          2   /* packet lost by the medium */
+#define TR_CORRUPT       3   /* packet corrupted by the medium */
+#define TR_TOLAYER5      4   /* data delivered to the application */
+#define TR_TIMER_START   5
+#define TR_TIMER_STOP    6
+#define TR_SEND          7   /* sender transmits a new packet */
+#define TR_WINDOW_FULL   8   /* message dropped, send window full */
+#define TR_ACK           9   /* uncorrupted ACK received, TRF_DUP if not new */
+#define TR_ACK_CORRUPT  10   /* corrupted ACK received */
+#define TR_TIMEOUT      11   /* sender timer expired */
+#define TR_RESEND       12   /* sender retransmits a packet */
+#define TR_RECV         13   /* receiver got an uncorrupted packet, TRF_DUP if not new */
+#define TR_RECV_CORRUPT 14   /* receiver got a corrupted packet */
+#define TR_WINDOW_SLIDE 15   /* send window base moved to seq */
+#define TR_GIVEUP       16   /* sender gave up on seq: too many retransmissions, or over its budget */
+#define TR_NAK_SEND     17   /* receiver asks for seq again (SR built with SR_NAK) */
+#define TR_NAK          18   /* sender got a NAK for seq, TRF_DUP if it did not resend */
+#define TR_SKIP_SEND    19   /* sender tells the receiver to skip to seq (SR_PARTIAL), TRF_DUP if resent */
+#define TR_SKIP         20   /* receiver got a skip to seq, ack = its receive base after, TRF_DUP if old */
+#define TR_NTYPES       21
+
+/* record flags */
+#define TRF_DUP 0x1
+
+struct trace_rec {
+  double time;       /* simulation time */
+  int32_t seq;       /* sequence number, or -1 */
+  int32_t ack;       /* acknowledgement number, or -1 */
+  uint8_t type;      /* TR_* */
+  uint8_t entity;    /* A or B */
+  uint16_t flags;    /* TRF_*, or the event type for TR_EVENT */
+  uint32_t flow;     /* flow of the entity; also keeps records 24 bytes */
+};
+
+/* file layout: one header, then records back to back */
+#define TRACE_MAGIC   "SRTRACE"
+#define TRACE_VERSION 1
+
+struct trace_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t recsize;   /* sizeof(struct trace_rec) of the writer */
+};
+
+#define TRACE_RING_SIZE 1024   /* records kept for post-mortem dumps, power of two */
+
+extern int trace_enabled;    /* set while a trace file is open */
+extern _Thread_local double trace_time;    /* current simulation time, kept by the emulator */
+extern int trace_flow;       /* flow of the current event, kept by the emulator */
+extern _Thread_local struct trace_rec trace_ring[TRACE_RING_SIZE];
+extern _Thread_local unsigned int trace_ring_next;   /* total records ever put in the ring */
+extern _Thread_local unsigned int trace_ring_dumped; /* trace_ring_next at the last dump */
+
+extern int trace_open(const char *path);
+extern void trace_close(void);
+extern void trace_write(const struct trace_rec *r);
+extern void trace_ring_dump(const char *why);
+
+/* decoding helpers, shared with tracedump */
+extern const char *trace_type_name(int type);
+extern void trace_print(FILE *out, const struct trace_rec *r);
+extern void trace_print_csv(FILE *out, const struct trace_rec *r);
+
+/* record an event: a few stores into the ring, plus a copy into the */
+/* file buffer while a trace file is open                             */
+#define TRACE_EVENT(type_, entity_, seq_, ack_, flags_) do { \
+    struct trace_rec *tr_ = &trace_ring[trace_ring_next++ & (TRACE_RING_SIZE - 1)]; \
+    tr_->time = trace_time; \
+    tr_->seq = (seq_); \
+    tr_->ack = (ack_); \
+    tr_->type = (type_); \
+    tr_->entity = (entity_); \
+    tr_->flags = (flags_); \
+    tr_->flow = trace_flow; \
+    if (trace_enabled) \
+      trace_write(tr_); \
+  } while (0)
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+/* ******************************************************************
+   Decoder for binary event traces written with the emulator's -t option.
+
+   Build: gcc -o tracedump tracedump.c trace.c
+   Usage: ./tracedump [-csv] tracefile
+
+   Without options the records are printed in the format of the TRACE
+   printfs; -csv prints one comma separated line per record instead.
+**********************************************************************/
+
+#define READ_BLOCK 4096
+
+int main(int argc, char **argv)
+{
+  struct trace_header hdr;
+  struct trace_rec recs[READ_BLOCK];
+  const char *path = NULL;
+  int csv = 0;
+  FILE *fp;
+  size_t n, i;
+  int a;
+
+  for (a = 1; a < argc; a++) {
+    if (strcmp(argv[a], "-csv") == 0)
+      csv = 1;
+    else if (path == NULL)
+      path = argv[a];
+    else {
+      path = NULL;   /* more than one file: print usage */
+      break;
+    }
+  }
+  if (path == NULL) {
+    printf("usage: %s [-csv] tracefile\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) {
+    printf("cannot open %s\n", path);
+    return EXIT_FAILURE;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+    printf("%s is not a trace file\n", path);
+    return EXIT_FAILURE;
+  }
+  if (hdr.version != TRACE_VERSION || hdr.recsize != sizeof(struct trace_rec)) {
+    printf("%s: unsupported trace version %u (record size %u)\n", path, hdr.version, hdr.recsize);
+    return EXIT_FAILURE;
+  }
+
+  if (csv)
+    printf("time,event,entity,seq,ack,flags,flow\n");
+  while ((n = fread(recs, sizeof(struct trace_rec), READ_BLOCK, fp)) > 0) {
+    for (i = 0; i < n; i++) {
+      if (csv)
+        trace_print_csv(stdout, &recs[i]);
+      else
+        trace_print(stdout, &recs[i]);
+    }
+  }
+  fclose(fp);
+  return EXIT_SUCCESS;
+}
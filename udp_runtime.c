@@ -0,0 +1,728 @@
+#define _GNU_SOURCE     /* sendmmsg, recvmmsg */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "emulator.h"
+#include "checksum.h"
+#include "eventq.h"     /* event types, for the trace */
+#include "trace.h"
+#include "sr.h"         /* gbn.h declares the same entry points */
+
+/* ******************************************************************
+   UDP runtime: runs the unchanged SR or GBN entities over real sockets
+   instead of inside the discrete event emulator (Linux only).
+
+   Build: gcc -O2 -o sr_udp sr.c udp_runtime.c checksum.c trace.c -Wall
+          (from ./gbn: gcc -O2 -I.. -o gbn_udp gbn.c ../udp_runtime.c
+           ../checksum.c ../trace.c -Wall)
+   Usage: ./sr_udp [-B] [-c sum|inet|crc32c] [-u usec] [-t file]
+
+   A and B each own a UDP socket on 127.0.0.1, connected to each other,
+   so tolayer3() is one send().  Each entity's timer is a timerfd, and
+   one epoll loop waits on the sockets and the timers.  Simulation time
+   units become -u microseconds of real time (default 100), so the RTT
+   of 16 units the protocols use is 1.6ms.
+
+   The parameters are read from stdin as by the emulator.  The loss and
+   corruption probabilities are applied before a datagram is sent.  With
+   an average time between messages of 0, a new message is offered as
+   soon as the window has room; a message the window refuses is offered
+   again later, not dropped.  Otherwise messages are offered every
+   lambda time units.  The run ends once every message has been offered
+   and no timer is running or traffic has stopped.  Message n carries
+   its number in the payload, so its latency from layer 5 at A to layer
+   5 at B is measured on delivery.
+
+   With -B the packets an entity sends while handling events are queued
+   and handed to the kernel with one sendmmsg() when the handler returns,
+   and arriving datagrams are taken BATCH at a time with recvmmsg().  A
+   GBN timeout resends its window in one call, and the ACKs B sends for a
+   batch of packets go out together.  Without -B every packet costs one
+   send() and one recv(), the baseline the syscall counts are compared to.
+**********************************************************************/
+
+#define DEFAULT_UNIT_US 100
+#define IDLE_UNITS      200      /* time units without traffic that end the run */
+#define SENT_RING       65536    /* messages in flight whose send time is kept */
+#define MAX_EVENTS      16
+#define BATCH           64       /* datagrams per sendmmsg/recvmmsg with -B */
+
+/* epoll tags */
+#define EV_SOCKET 0              /* + A or B */
+#define EV_TIMER  2              /* + A or B */
+#define EV_PACE   4
+
+int TRACE = 0;
+int nflows = 1;           /* one A/B pair */
+int current_flow = 0;
+
+/* statistics updated by the protocols */
+int window_full;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+
+static int nsim = 0;              /* messages offered and taken, or dropped */
+static int nsimmax = 0;
+static float lossprob;
+static float corruptprob;
+static int corruptdirection;
+static float lambda;
+static long unit_ns = DEFAULT_UNIT_US * 1000L;
+
+static int sock[2] = { -1, -1 };  /* sockets of A and B */
+static int timerfd[2] = { -1, -1 };
+static int timer_running[2];
+static int pacefd = -1;           /* offers messages every lambda, if lambda > 0 */
+static int epfd;
+
+static double started;            /* clock at the start of the run */
+static double last_delivery;      /* clock at the last delivery to layer 5 */
+static int messages_delivered;
+static int refused;               /* offers the window refused (lambda 0) */
+static long ntolayer3, nlost, ncorrupt, nsockdrop;
+static long nreceived;               /* datagrams read from the sockets */
+static long nsendcalls, nrecvcalls;  /* send/sendmmsg and recv/recvmmsg calls */
+
+static int batching;                 /* -B */
+static struct pkt outq[2][BATCH];    /* datagrams each socket has yet to send */
+static int noutq[2];
+static double sent_at[SENT_RING];    /* when message n was taken by A */
+static int sent_num[SENT_RING];      /* n, to match a delivery */
+static double *latency;              /* of every delivered message, seconds */
+static long nlatency;
+static long unmatched;               /* deliveries without a known send time */
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double jimsrand(void)
+{
+  return rand() / (double)RAND_MAX;
+}
+
+/************************** PACKET POOL ***************/
+/* as in the emulator: the pkt is the first member, a handle points to it */
+struct pktbuf {
+  struct pkt pkt;
+  int refcount;
+  struct pktbuf *nextfree;
+};
+
+#define PKTPOOL_CHUNK 64
+
+static struct pktbuf *pktfree = NULL;
+
+struct pkt *pkt_alloc(void)
+{
+  struct pktbuf *b;
+  int i;
+
+  if (pktfree == NULL) {
+    b = malloc(PKTPOOL_CHUNK * sizeof(struct pktbuf));
+    if (b == NULL) {
+      printf("memory allocation for packet pool failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<PKTPOOL_CHUNK; i++) {
+      b[i].nextfree = pktfree;
+      pktfree = &b[i];
+    }
+  }
+  b = pktfree;
+  pktfree = b->nextfree;
+  b->refcount = 1;
+  return &b->pkt;
+}
+
+void pkt_hold(struct pkt *packet)
+{
+  ((struct pktbuf *)packet)->refcount++;
+}
+
+void pkt_release(struct pkt *packet)
+{
+  struct pktbuf *b = (struct pktbuf *)packet;
+
+  if (--b->refcount == 0) {
+    b->nextfree = pktfree;
+    pktfree = b;
+  }
+}
+
+/************************** LAYER 3 AND 5 ***************/
+
+/* send the datagrams queued on one socket with one system call */
+static void flush(int AorB)
+{
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, n = noutq[AorB], sent;
+
+  if (n == 0)
+    return;
+  memset(msgs, 0, n * sizeof(struct mmsghdr));
+  for (i=0; i<n; i++) {
+    iov[i].iov_base = &outq[AorB][i];
+    iov[i].iov_len = sizeof(struct pkt);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  nsendcalls++;
+  sent = sendmmsg(sock[AorB], msgs, n, 0);
+  if (sent < 0)
+    sent = 0;
+  nsockdrop += n - sent;        /* the rest did not fit in the socket buffer */
+  noutq[AorB] = 0;
+}
+
+static void flush_all(void)
+{
+  flush(A);
+  flush(B);
+}
+
+/* the datagram is copied before it is sent or queued, so the caller */
+/* keeps its packet                                                  */
+void tolayer3_ref(int AorB, struct pkt *packet)
+{
+  struct pkt copy;
+  int affected;
+
+  ntolayer3++;
+  affected = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+  if (affected && jimsrand() < lossprob) {
+    nlost++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    TRACE_EVENT(TR_LOST, AorB, packet->seqnum, packet->acknum, 0);
+    return;
+  }
+  copy = *packet;
+  if (affected && jimsrand() < corruptprob) {
+    ncorrupt++;
+    copy.payload[0] = 'Z';
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being corrupted\n");
+    TRACE_EVENT(TR_CORRUPT, AorB, copy.seqnum, copy.acknum, 0);
+  }
+  TRACE_EVENT(TR_TOLAYER3, AorB, copy.seqnum, copy.acknum, 0);
+  if (batching) {
+    outq[AorB][noutq[AorB]++] = copy;
+    if (noutq[AorB] == BATCH)
+      flush(AorB);
+    return;
+  }
+  nsendcalls++;
+  /* a full socket buffer drops the datagram, as a network would */
+  if (send(sock[AorB], &copy, sizeof(copy), 0) != sizeof(copy))
+    nsockdrop++;
+}
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  tolayer3_ref(AorB, &packet);
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  char num[11];
+  int n;
+
+  if (TRACE>2)
+    printf("          TOLAYER5: data received by application at %c: %.20s\n", AorB == A ? 'A' : 'B', datasent);
+  TRACE_EVENT(TR_TOLAYER5, AorB, -1, -1, 0);
+  messages_delivered++;
+  last_delivery = now();
+  memcpy(num, datasent, 10);
+  num[10] = '\0';
+  n = atoi(num);
+  if (sent_num[n % SENT_RING] == n && sent_at[n % SENT_RING] > 0.0) {
+    latency[nlatency++] = last_delivery - sent_at[n % SENT_RING];
+    sent_at[n % SENT_RING] = 0.0;      /* a duplicate delivery is not timed again */
+  }
+  else
+    unmatched++;
+}
+
+/* messages are timed by the number they carry, so a skipped one is only traced */
+void tolayer5_skip(int AorB)
+{
+  if (TRACE>2)
+    printf("          TOLAYER5: message skipped at %c\n", AorB == A ? 'A' : 'B');
+}
+
+/************************** TIMERS ***************/
+
+static void settimer(int AorB, long ns)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = ns / 1000000000L;
+  its.it_value.tv_nsec = ns % 1000000000L;
+  if (timerfd_settime(timerfd[AorB], 0, &its, NULL) < 0) {
+    printf("timerfd_settime failed: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+void starttimer(int AorB, double increment)
+{
+  long ns;
+
+  if (TRACE>1)
+    printf("          START TIMER: starting timer\n");
+  TRACE_EVENT(TR_TIMER_START, AorB, -1, -1, 0);
+  if (timer_running[AorB]) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  ns = (long)(increment * unit_ns);
+  settimer(AorB, ns > 0 ? ns : 1);     /* 0 would disarm it */
+  timer_running[AorB] = 1;
+}
+
+/* disarming also clears an expiry not read yet */
+void stoptimer(int AorB)
+{
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer\n");
+  TRACE_EVENT(TR_TIMER_STOP, AorB, -1, -1, 0);
+  if (!timer_running[AorB]) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  settimer(AorB, 0);
+  timer_running[AorB] = 0;
+}
+
+/* time since the start, in time units */
+double get_sim_time(void)
+{
+  return (now() - started) * 1e9 / unit_ns;
+}
+
+/* checkpoints belong to the emulator */
+void ckpt_write(FILE *fp, const void *data, size_t len)
+{
+  printf("checkpoints are not supported by the UDP runtime\n");
+  exit(EXIT_FAILURE);
+}
+
+void ckpt_read(FILE *fp, void *data, size_t len)
+{
+  ckpt_write(fp, data, len);
+}
+
+void ckpt_write_pkt(FILE *fp, const struct pkt *packet)
+{
+  ckpt_write(fp, NULL, 0);
+}
+
+struct pkt *ckpt_read_pkt(FILE *fp)
+{
+  ckpt_write(fp, NULL, 0);
+  return NULL;
+}
+
+/* resends per packet are only sampled by the emulator (-s) */
+void record_resends(int resends)
+{
+}
+
+/************************** LAYER 5 ***************/
+
+/* message n: its number in ten digits, then letters */
+static void make_msg(struct msg *m, int n)
+{
+  char num[11];
+  int i;
+
+  snprintf(num, sizeof(num), "%010d", n);
+  memcpy(m->data, num, 10);
+  for (i=10; i<20; i++)
+    m->data[i] = 'a' + n % 26;
+}
+
+/* hand message nsim to A; returns 0 if the window refused it */
+static int offer(void)
+{
+  struct msg m;
+  int before = window_full;
+
+  make_msg(&m, nsim);
+  sent_num[nsim % SENT_RING] = nsim;
+  sent_at[nsim % SENT_RING] = now();
+  A_output(m);
+  return window_full == before;
+}
+
+/* lambda 0: keep the window full, retrying refused messages later */
+static void offer_while_room(void)
+{
+  while (nsim < nsimmax) {
+    if (!offer()) {
+      window_full--;        /* not dropped: it is offered again */
+      refused++;
+      sent_at[nsim % SENT_RING] = 0.0;
+      return;
+    }
+    nsim++;
+  }
+}
+
+/************************** SETUP ***************/
+
+static int udp_socket(void)
+{
+  struct sockaddr_in addr;
+  int s;
+
+  s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (s < 0) {
+    printf("cannot create UDP socket: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;        /* any free port */
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    printf("cannot bind UDP socket: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return s;
+}
+
+static void connect_to(int s, int peer)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  if (getsockname(peer, (struct sockaddr *)&addr, &len) < 0 ||
+      connect(s, (struct sockaddr *)&addr, len) < 0) {
+    printf("cannot connect UDP sockets: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void watch(int fd, int tag)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = tag;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    printf("epoll_ctl failed: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+static int new_timerfd(void)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+  if (fd < 0) {
+    printf("timerfd_create failed: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+static void setup(void)
+{
+  struct itimerspec its;
+  long ns;
+  int i;
+
+  epfd = epoll_create1(0);
+  if (epfd < 0) {
+    printf("epoll_create1 failed: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  sock[A] = udp_socket();
+  sock[B] = udp_socket();
+  connect_to(sock[A], sock[B]);
+  connect_to(sock[B], sock[A]);
+  for (i=A; i<=B; i++) {
+    timerfd[i] = new_timerfd();
+    watch(sock[i], EV_SOCKET + i);
+    watch(timerfd[i], EV_TIMER + i);
+  }
+  if (lambda > 0.0) {
+    pacefd = new_timerfd();
+    watch(pacefd, EV_PACE);
+    ns = (long)(lambda * unit_ns);
+    if (ns < 1)
+      ns = 1;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = its.it_interval.tv_sec = ns / 1000000000L;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = ns % 1000000000L;
+    timerfd_settime(pacefd, 0, &its, NULL);
+  }
+  latency = malloc((nsimmax > 0 ? nsimmax : 1) * sizeof(double));
+  if (latency == NULL) {
+    printf("memory allocation for latencies failed.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void init(void)
+{
+  printf("-----  UDP runtime over loopback -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [0.0 for as fast as the window allows]:");
+  scanf("%f",&lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+  srand(9999);
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [options] < parameters\n", prog);
+  printf("  -B          batch datagrams with sendmmsg/recvmmsg\n");
+  printf("  -c kernel   checksum used by the protocol entities (default sum)\n");
+  printf("  -t file     write a binary event trace, decode it with tracedump\n");
+  printf("  -u usec     real time of one time unit (default %d)\n", DEFAULT_UNIT_US);
+  exit(EXIT_FAILURE);
+}
+
+static void parseargs(int argc, char **argv)
+{
+  int i;
+
+  for (i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-B") == 0)
+      batching = 1;
+    else if (strcmp(argv[i], "-c") == 0 && i+1 < argc) {
+      if (checksum_select(argv[++i]) < 0)
+        usage(argv[0]);
+    }
+    else if (strcmp(argv[i], "-t") == 0 && i+1 < argc) {
+      if (trace_open(argv[++i]) < 0) {
+        printf("cannot open trace file %s\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (strcmp(argv[i], "-u") == 0 && i+1 < argc) {
+      unit_ns = (long)(atof(argv[++i]) * 1000);
+      if (unit_ns < 1)
+        usage(argv[0]);
+    }
+    else
+      usage(argv[0]);
+  }
+}
+
+/************************** MAIN LOOP ***************/
+
+static void deliver(int AorB, const struct pkt *buf)
+{
+  struct pkt *p;
+
+  nreceived++;
+  p = pkt_alloc();
+  *p = *buf;
+  TRACE_EVENT(TR_EVENT, AorB, -1, -1, FROM_LAYER3);
+  if (AorB == A)
+    A_input_ref(p);
+  else
+    B_input_ref(p);
+  pkt_release(p);
+}
+
+static void receive(int AorB)
+{
+  static struct pkt bufs[BATCH];
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, n;
+
+  if (!batching) {
+    do {
+      nrecvcalls++;
+      if (recv(sock[AorB], &bufs[0], sizeof(struct pkt), 0) != sizeof(struct pkt))
+        return;
+      deliver(AorB, &bufs[0]);
+    } while (1);
+  }
+  /* a short batch means the socket is drained; if more arrives, */
+  /* epoll reports the socket again                              */
+  do {
+    memset(msgs, 0, sizeof(msgs));
+    for (i=0; i<BATCH; i++) {
+      iov[i].iov_base = &bufs[i];
+      iov[i].iov_len = sizeof(struct pkt);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    nrecvcalls++;
+    n = recvmmsg(sock[AorB], msgs, BATCH, 0, NULL);
+    for (i=0; i<n; i++)
+      if (msgs[i].msg_len == sizeof(struct pkt))
+        deliver(AorB, &bufs[i]);
+    flush_all();
+  } while (n == BATCH);
+}
+
+static void expire(int AorB)
+{
+  uint64_t n;
+
+  /* nothing to read if the timer was stopped after it went off */
+  if (read(timerfd[AorB], &n, sizeof(n)) != sizeof(n) || !timer_running[AorB])
+    return;
+  timer_running[AorB] = 0;
+  TRACE_EVENT(TR_EVENT, AorB, -1, -1, TIMER_INTERRUPT);
+  if (AorB == A)
+    A_timerinterrupt();
+  else
+    B_timerinterrupt();
+}
+
+static void pace(void)
+{
+  uint64_t n;
+
+  if (read(pacefd, &n, sizeof(n)) != sizeof(n))
+    return;
+  while (n-- > 0 && nsim < nsimmax) {
+    TRACE_EVENT(TR_EVENT, A, -1, -1, FROM_LAYER5);
+    offer();              /* the protocol counts a refused message */
+    nsim++;
+  }
+  if (nsim == nsimmax)
+    timerfd_settime(pacefd, 0, &(struct itimerspec){ { 0, 0 }, { 0, 0 } }, NULL);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(double p)
+{
+  long i = (long)(p * nlatency + 0.999999) - 1;
+
+  if (i < 0)
+    i = 0;
+  return latency[i];
+}
+
+static void print_stats(double wall)
+{
+  long sent;
+
+  printf(" Runtime stopped after %f s\n after attempting to send %d msgs from layer5\n", now() - started, nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  printf("number of correct packets received at B:  %d \n", packets_received);
+  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  protocol_print_stats(stdout);
+  if (lambda == 0.0)
+    printf("messages offered again after the window refused them:  %d \n", refused);
+  printf("datagrams: %ld sent, %ld lost and %ld corrupted on purpose, %ld dropped by the socket\n",
+         ntolayer3, nlost, ncorrupt, nsockdrop);
+  printf("throughput: %.0f messages/s delivered in %.3f s\n", wall > 0.0 ? messages_delivered / wall : 0.0, wall);
+  if (nlatency > 0) {
+    qsort(latency, nlatency, sizeof(double), cmp_double);
+    printf("latency (us): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+           percentile(0.5) * 1e6, percentile(0.9) * 1e6, percentile(0.99) * 1e6,
+           percentile(0.999) * 1e6, latency[nlatency - 1] * 1e6);
+  }
+  /* per datagram passed to the kernel and per datagram read back */
+  sent = ntolayer3 - nlost;
+  printf("system calls (%s): %ld to send, %ld to receive, %.2f per datagram; %.0f datagrams/s\n",
+         batching ? "sendmmsg/recvmmsg" : "send/recv", nsendcalls, nrecvcalls,
+         sent + nreceived > 0 ? (double)(nsendcalls + nrecvcalls) / (sent + nreceived) : 0.0,
+         wall > 0.0 ? sent / wall : 0.0);
+  if (unmatched > 0)
+    printf("deliveries without a send time: %ld\n", unmatched);
+}
+
+int main(int argc, char **argv)
+{
+  struct epoll_event evs[MAX_EVENTS];
+  int i, n, tag, idle_ms;
+
+  parseargs(argc, argv);
+  init();
+  setup();
+  /* the clock starts before the entities, which may read it in A_init */
+  started = last_delivery = now();
+  A_init();
+  B_init();
+
+  idle_ms = (int)(IDLE_UNITS * unit_ns / 1000000);
+  if (lambda > 0.0 && idle_ms < 2 * lambda * unit_ns / 1000000)
+    idle_ms = (int)(2 * lambda * unit_ns / 1000000);
+  if (idle_ms < 10)
+    idle_ms = 10;
+
+  if (lambda == 0.0)
+    offer_while_room();
+  flush_all();
+  for (;;) {
+    if (nsim == nsimmax && !timer_running[A] && !timer_running[B])
+      break;              /* everything sent has been acknowledged or given up */
+    n = epoll_wait(epfd, evs, MAX_EVENTS, idle_ms);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      printf("epoll_wait failed: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    if (n == 0) {
+      printf("no traffic for %d ms, stopping\n", idle_ms);
+      break;
+    }
+    for (i=0; i<n; i++) {
+      tag = evs[i].data.u32;
+      trace_time = (now() - started) * 1e9 / unit_ns;
+      if (tag == EV_PACE)
+        pace();
+      else if (tag >= EV_TIMER)
+        expire(tag - EV_TIMER);
+      else
+        receive(tag - EV_SOCKET);
+    }
+    if (lambda == 0.0)
+      offer_while_room();
+    flush_all();
+  }
+
+  print_stats(last_delivery - started);
+  trace_close();
+  return EXIT_SUCCESS;
+}